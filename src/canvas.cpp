@@ -6,31 +6,126 @@
  */
 
 #include "canvas.h"
+#include "simd.h"
+#include <atomic>
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <thread>
 
 using namespace std;
 using namespace agl;
 
+namespace {
+  // return the overlap of two rects (empty if xmin > xmax or ymin > ymax)
+  Rect intersect(const Rect& a, const Rect& b) {
+    Rect r = {max(a.xmin, b.xmin), max(a.ymin, b.ymin), min(a.xmax, b.xmax),
+        min(a.ymax, b.ymax)};
+    return r;
+  }
+
+  bool isEmpty(const Rect& r) {
+    return r.xmin > r.xmax || r.ymin > r.ymax;
+  }
+
+  // blend color c with opacity alpha over pixel p, rounded the same way as
+  // Image::blend with BLEND_ALPHA
+  void blendOver(Pixel& p, const Pixel& c, int alpha) {
+    int beta = 255 - alpha;
+    int r = c.r * alpha + p.r * beta + 128;
+    int g = c.g * alpha + p.g * beta + 128;
+    int b = c.b * alpha + p.b * beta + 128;
+    p.r = (r + (r >> 8)) >> 8;
+    p.g = (g + (g >> 8)) >> 8;
+    p.b = (b + (b >> 8)) >> 8;
+  }
+
+  // blend c over p with an opacity in [0, 255] that already includes the
+  // pixel's coverage
+  void blendCoverage(Pixel& p, const Pixel& c, float opacity) {
+    int alpha = (int) (opacity + 0.5f);
+    if (alpha > 0) {
+      blendOver(p, c, min(alpha, 255));
+    }
+  }
+}
+
 Canvas::Canvas(int w, int h) : _canvas(w, h) {
   // default black color
   _color.r = 0;
   _color.g = 0;
   _color.b = 0;
+  _alpha = 255;  // opaque
   _primitive = UNDEFINED;  // nothing being drawn
+  _antialias = false;
+  _threads = 1;  // draw serially unless asked otherwise
+  _lineShading = LINE_FIXED_POINT;
+  _circleOutline = CIRCLE_MIDPOINT;
+  _curveTolerance = 0;  // fixed 1 degree steps
+  _segments = 0;
+  _collect = NULL;  // rasterize shapes as soon as they are emitted
+  _record = NULL;
 }
 
-Canvas::~Canvas() {  }  // Image destructor should free canvas already
+// Image destructor should free canvas already, and the SaveQueue
+// destructor finishes any saveAsync calls
+Canvas::~Canvas() {  }
 
 void Canvas::save(const std::string& filename) {
-  // save image as png file
+  // save image as png, raw, ppm or qoi file
   _canvas.save(filename);
 }
 
-void Canvas::begin(PrimitiveType type) {
+void Canvas::save(const std::string& filename, ImageFormat format) {
+  _canvas.save(filename, format);
+}
+
+void Canvas::save(const std::string& filename, const PngOptions& options) {
+  _canvas.save(filename, options);
+}
+
+void Canvas::save(const std::string& filename, const Rect& region) {
+  Rect r = intersect(region, fullRect());
+  if (isEmpty(r)) {
+    cout << "Error: cannot save empty region" << endl;
+    return;
+  }
+  _canvas.save(filename, r.xmin, r.ymin, r.xmax - r.xmin + 1,
+      r.ymax - r.ymin + 1);
+}
+
+SaveQueue& Canvas::saves() {
+  if (!_saves) {
+    _saves.reset(new SaveQueue());
+  }
+  return *_saves;
+}
+
+std::future<bool> Canvas::saveAsync(const std::string& filename) {
+  return saves().push(_canvas, filename);
+}
+
+std::future<bool> Canvas::saveAsync(const std::string& filename,
+    const PngOptions& options) {
+  return saves().push(_canvas, filename, options);
+}
+
+void Canvas::setSaveThreads(int threads, int capacity) {
+  // the old queue finishes its saves when it is destroyed
+  _saves.reset(new SaveQueue(threads, capacity));
+}
+
+void Canvas::waitForSaves() {
+  if (_saves) {
+    _saves->wait();
+  }
+}
+
+void Canvas::begin(PrimitiveType type, bool antialias) {
   if (_primitive == UNDEFINED && type != UNDEFINED) {
     // set primitive to signal "drawing in progress"
     _primitive = type;
+    _antialias = antialias;
   } else {
     // still have a drawing in progress (i.e. end() was not called yet)
     cout << "Error: cannot begin new drawing without ending previous" << endl;
@@ -38,6 +133,11 @@ void Canvas::begin(PrimitiveType type) {
 }
 
 void Canvas::end() {
+  if (_threads > 1 && _record == NULL) {
+    // buffer every shape so it can be sorted into tiles
+    _shapes.clear();
+    _collect = &_shapes;
+  }
   // draw the primitive specified
   if (_primitive == LINES) {
     drawLines(_vertices);
@@ -50,7 +150,12 @@ void Canvas::end() {
   } else if (_primitive == MAURERS) {
     drawMaurers();
   }
+  if (_collect == &_shapes) {
+    _collect = NULL;
+    drawTiled(_shapes, fullRect());
+  }
   _primitive = UNDEFINED;  // signal no further drawing
+  _antialias = false;
   _vertices.clear();  // reset vertex list
 }
 
@@ -59,7 +164,7 @@ void Canvas::end() {
 void Canvas::vertex(int x, int y, bool fill) {
   if (_primitive == LINES || _primitive == TRIANGLES) {
     // clip vertex to size of canvas
-    Vertex vertex = {x, y, 1, 0, 0, _color, fill};
+    Vertex vertex = {x, y, 1, 0, 0, _color, fill, _alpha};
     clamp(vertex);
     _vertices.push_back(vertex);
   } else {
@@ -72,12 +177,12 @@ void Canvas::center(int x, int y, int radius, int n, int d, bool fill) {
   if (_primitive == CIRCLES) {
     // don't necessarily need to clamp center coordinates,
     // just clamp lines when drawing circumference
-    Vertex center = {x, y, radius, 0, 0, _color, fill};
+    Vertex center = {x, y, radius, 0, 0, _color, fill, _alpha};
     _vertices.push_back(center);
   } else if (_primitive == ROSES || _primitive == MAURERS) {
     // "radius" parameter treated as amplitude for rose curves
     // rose curves cannot be filled currently
-    Vertex center = {x, y, radius, n, d, _color, false};
+    Vertex center = {x, y, radius, n, d, _color, false, _alpha};
     _vertices.push_back(center);
   } else {
     cout << "Error: cannot draw center without circular type" << endl;
@@ -88,48 +193,480 @@ void Canvas::color(unsigned char r, unsigned char g, unsigned char b) {
   _color.r = r;
   _color.g = g;
   _color.b = b;
+  _alpha = 255;
+}
+
+void Canvas::color(unsigned char r, unsigned char g, unsigned char b,
+    unsigned char a) {
+  color(r, g, b);
+  _alpha = a;
 }
 
 void Canvas::background(unsigned char r, unsigned char g, unsigned char b) {
-  int numPixels = _canvas.width() * _canvas.height();
   Pixel color = {r, g, b};
   // color every pixel, erasing any drawn lines
-  for (int i = 0; i < numPixels; i++) {
-    _canvas.set(i, color);
+  _canvas.fill(color);
+  markDirty(fullRect());
+}
+
+void Canvas::background(unsigned char r, unsigned char g, unsigned char b,
+    const Rect& region) {
+  Pixel color = {r, g, b};
+  Rect cleared = intersect(region, fullRect());
+  _canvas.fillRect(cleared.xmin, cleared.ymin, cleared.xmax - cleared.xmin + 1,
+      cleared.ymax - cleared.ymin + 1, color);
+  markDirty(cleared);
+}
+
+void Canvas::setThreads(int n) {
+  _threads = max(n, 1);
+}
+
+int Canvas::threads() const {
+  return _threads;
+}
+
+void Canvas::setLineShading(LineShading shading) {
+  _lineShading = shading;
+}
+
+void Canvas::setCircleOutline(CircleOutline outline) {
+  _circleOutline = outline;
+}
+
+void Canvas::setCurveTolerance(float pixels) {
+  _curveTolerance = max(pixels, 0.0f);
+}
+
+void Canvas::beginRecord(DisplayList& list) {
+  _record = &list;
+}
+
+void Canvas::endRecord() {
+  _record = NULL;
+}
+
+void Canvas::draw(const DisplayList& list) {
+  draw(list, fullRect());
+}
+
+void Canvas::draw(const DisplayList& list, const Rect& region) {
+  Rect clip = intersect(region, fullRect());
+  if (isEmpty(clip)) {
+    return;
+  }
+  _shapes.clear();
+  for (int i = 0; i < list.size(); i++) {
+    Shape shape = list.shape(i);
+    Rect r = intersect(bounds(shape), clip);
+    if (isEmpty(r)) {
+      continue;  // entirely outside the region
+    }
+    markDirty(r);
+    if (_threads > 1) {
+      _shapes.push_back(shape);
+    } else {
+      drawShape(shape, clip);
+    }
+  }
+  if (_threads > 1) {
+    drawTiled(_shapes, clip);
+  }
+}
+
+const vector<Rect>& Canvas::dirtyRects() const {
+  return _dirty;
+}
+
+Rect Canvas::dirtyBounds() const {
+  Rect r = {0, 0, -1, -1};
+  for (int i = 0; i < _dirty.size(); i++) {
+    if (i == 0) {
+      r = _dirty[i];
+    } else {
+      r.xmin = min(r.xmin, _dirty[i].xmin);
+      r.ymin = min(r.ymin, _dirty[i].ymin);
+      r.xmax = max(r.xmax, _dirty[i].xmax);
+      r.ymax = max(r.ymax, _dirty[i].ymax);
+    }
+  }
+  return r;
+}
+
+void Canvas::clearDirty() {
+  _dirty.clear();
+}
+
+long Canvas::segmentCount() const {
+  return _segments;
+}
+
+const Image& Canvas::image() const {
+  return _canvas;
+}
+
+void DisplayList::clear() {
+  _records.clear();
+}
+
+int DisplayList::size() const {
+  return _records.size();
+}
+
+void DisplayList::add(const Shape& shape) {
+  Record r;
+  r.type = shape.type;
+  r.fill = shape.v[0].fill;
+  r.antialias = shape.antialias;
+  r.joined = shape.joined;
+  r.closing = shape.closing;
+  r.radius = shape.v[0].radius;
+  for (int i = 0; i < 3; i++) {
+    r.x[i] = shape.v[i].x;
+    r.y[i] = shape.v[i].y;
+    r.color[i] = shape.v[i].color;
+    r.alpha[i] = shape.v[i].alpha;
+  }
+  for (int i = 0; i < 2; i++) {
+    r.fx[i] = shape.v[i].fx;
+    r.fy[i] = shape.v[i].fy;
   }
+  _records.push_back(r);
+}
+
+Shape DisplayList::shape(int i) const {
+  const Record& r = _records[i];
+  Shape s;
+  s.type = r.type;
+  for (int k = 0; k < 3; k++) {
+    Vertex v = {r.x[k], r.y[k], r.radius, 0, 0, r.color[k], r.fill,
+        r.alpha[k]};
+    if (k < 2) {
+      v.fx = r.fx[k];
+      v.fy = r.fy[k];
+    }
+    s.v[k] = v;
+  }
+  s.antialias = r.antialias;
+  s.joined = r.joined;
+  s.closing = r.closing;
+  return s;
 }
 
 //------------------------------------------------------------//
 //------------------------------------------------------------//
 
-void Canvas::drawLines(vector<Vertex>& points) {
+void Canvas::emit(Shape shape) {
+  shape.antialias = _antialias;
+  if (shape.type == LINES) {
+    _segments++;
+  }
+  if (_record != NULL) {
+    _record->add(shape);
+    return;
+  }
+  if (_collect != NULL) {
+    _collect->push_back(shape);
+  } else {
+    drawShape(shape, fullRect());
+  }
+  markDirty(bounds(shape));
+}
+
+void Canvas::drawShape(const Shape& shape, const Rect& clip) {
+  if (shape.type == LINES && shape.antialias) {
+    drawLineSmooth(shape.v[0], shape.v[1], shape.joined, shape.closing,
+        clip);
+  } else if (shape.type == LINES) {
+    drawLine(shape.v[0], shape.v[1], shape.joined, shape.closing, clip);
+  } else if (shape.type == TRIANGLES) {
+    drawTriangleFill(shape.v[0], shape.v[1], shape.v[2], clip);
+  } else if (shape.type == CIRCLES && shape.v[0].fill) {
+    if (shape.antialias) {
+      drawCircleFillSmooth(shape.v[0], clip);
+    } else {
+      drawCircleFill(shape.v[0], clip);
+    }
+  } else if (shape.type == CIRCLES) {
+    if (shape.antialias) {
+      drawCircleOutlineSmooth(shape.v[0], clip);
+    } else {
+      drawCircleOutline(shape.v[0], clip);
+    }
+  }
+}
+
+Rect Canvas::bounds(const Shape& shape) const {
+  Rect r;
+  if (shape.type == CIRCLES) {
+    const Vertex& c = shape.v[0];
+    r = {c.x - c.radius, c.y - c.radius, c.x + c.radius, c.y + c.radius};
+  } else {
+    // lines only use the first two vertices
+    int count = (shape.type == LINES) ? 2 : 3;
+    r = {shape.v[0].x, shape.v[0].y, shape.v[0].x, shape.v[0].y};
+    for (int i = 1; i < count; i++) {
+      r.xmin = min(r.xmin, shape.v[i].x);
+      r.ymin = min(r.ymin, shape.v[i].y);
+      r.xmax = max(r.xmax, shape.v[i].x);
+      r.ymax = max(r.ymax, shape.v[i].y);
+    }
+    if (shape.type == LINES && shape.antialias) {
+      // coverage spills onto the pixel past the line's box on the minor axis
+      r = {r.xmin - 1, r.ymin - 1, r.xmax + 1, r.ymax + 1};
+    }
+  }
+  return intersect(r, fullRect());
+}
+
+void Canvas::drawTiled(const vector<Shape>& shapes, const Rect& region) {
+  const int tileSize = 64;
+  int tilesX = (_canvas.width() + tileSize - 1) / tileSize;
+  int tilesY = (_canvas.height() + tileSize - 1) / tileSize;
+  // each tile keeps the indices of shapes that touch it, in submission
+  // order, so overlapping shapes are drawn in the same order as serially
+  vector<vector<int>> bins(tilesX * tilesY);
+  for (int i = 0; i < shapes.size(); i++) {
+    Rect r = intersect(bounds(shapes[i]), region);
+    if (isEmpty(r)) {
+      continue;  // entirely outside the region
+    }
+    for (int ty = r.ymin / tileSize; ty <= r.ymax / tileSize; ty++) {
+      for (int tx = r.xmin / tileSize; tx <= r.xmax / tileSize; tx++) {
+        bins[ty * tilesX + tx].push_back(i);
+      }
+    }
+  }
+  // workers take the next unclaimed tile until none are left; every pixel
+  // belongs to exactly one tile, so workers never write the same pixel
+  atomic<int> nextTile(0);
+  auto worker = [&]() {
+    for (int t = nextTile++; t < bins.size(); t = nextTile++) {
+      int x = (t % tilesX) * tileSize;
+      int y = (t / tilesX) * tileSize;
+      Rect tile = {x, y, min(x + tileSize, _canvas.width()) - 1,
+          min(y + tileSize, _canvas.height()) - 1};
+      Rect clip = intersect(tile, region);
+      if (isEmpty(clip)) {
+        continue;
+      }
+      for (int i : bins[t]) {
+        drawShape(shapes[i], clip);
+      }
+    }
+  };
+  int numWorkers = min(_threads, (int) bins.size());
+  vector<thread> pool;
+  for (int i = 1; i < numWorkers; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();  // calling thread also rasterizes
+  for (thread& t : pool) {
+    t.join();
+  }
+}
+
+Rect Canvas::fullRect() const {
+  Rect r = {0, 0, _canvas.width() - 1, _canvas.height() - 1};
+  return r;
+}
+
+void Canvas::markDirty(const Rect& r) {
+  if (isEmpty(r)) {
+    return;  // nothing drawn
+  }
+  Rect merged = r;
+  // absorb every dirty rect that overlaps or touches the new one; the
+  // union may now touch rects that were skipped, so rescan until stable
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < _dirty.size(); i++) {
+      const Rect& d = _dirty[i];
+      if (d.xmin <= merged.xmax + 1 && d.xmax >= merged.xmin - 1 &&
+          d.ymin <= merged.ymax + 1 && d.ymax >= merged.ymin - 1) {
+        merged.xmin = min(merged.xmin, d.xmin);
+        merged.ymin = min(merged.ymin, d.ymin);
+        merged.xmax = max(merged.xmax, d.xmax);
+        merged.ymax = max(merged.ymax, d.ymax);
+        _dirty[i] = _dirty.back();
+        _dirty.pop_back();
+        changed = true;
+        break;
+      }
+    }
+  }
+  _dirty.push_back(merged);
+  if (_dirty.size() > 32) {
+    Rect all = dirtyBounds();
+    _dirty.clear();
+    _dirty.push_back(all);
+  }
+}
+
+void Canvas::drawLines(vector<Vertex>& points, bool joined, bool closed) {
   int numLines = points.size() / 2;
   for (int i = 0; i < numLines; i++) {
-    Vertex a = points[i * 2];
-    Vertex b = points[i * 2 + 1];
-    int w = b.x - a.x;
-    int h = b.y - a.y;
-    if (abs(h) < abs(w)) {
-      if (a.x > b.x) {
-        // swap a and b
-        Vertex temp = b;
-        b = a;
-        a = temp;
+    Shape line = {LINES, {points[i * 2], points[i * 2 + 1]}};
+    line.joined = joined && i > 0;
+    line.closing = closed && i > 0 && i == numLines - 1;
+    emit(line);
+  }
+}
+
+void Canvas::drawLine(const Vertex& p0, const Vertex& p1, bool joined,
+    bool closing, const Rect& clip) {
+  int w = p1.x - p0.x;
+  int h = p1.y - p0.y;
+  bool low = abs(h) < abs(w);
+  // a translucent curve would blend the pixel its lines share twice, so the
+  // previous line keeps it (and the first line keeps the one a closing line
+  // ends on); opaque lines just overwrite it
+  int skip0 = INT_MIN;
+  int skip1 = INT_MIN;
+  if (p0.alpha < 255 || p1.alpha < 255) {
+    skip0 = joined ? (low ? p0.x : p0.y) : INT_MIN;
+    skip1 = closing ? (low ? p1.x : p1.y) : INT_MIN;
+  }
+  if (_lineShading == LINE_FIXED_POINT) {
+    drawLineFixed(p0, p1, skip0, skip1, clip);
+    return;
+  }
+  Vertex a = p0;
+  Vertex b = p1;
+  if (low) {
+    if (a.x > b.x) {
+      // swap a and b
+      Vertex temp = b;
+      b = a;
+      a = temp;
+    }
+    drawLineLow(a, b, skip0, skip1, clip);
+  } else {
+    if (a.y > b.y) {
+      // swap a and b
+      Vertex temp = b;
+      b = a;
+      a = temp;
+    }
+    drawLineHigh(a, b, skip0, skip1, clip);
+  }
+}
+
+void Canvas::drawLineFixed(const Vertex& a, const Vertex& b, int skip0,
+    int skip1, const Rect& clip) {
+  int w = abs(b.x - a.x);  // width
+  int h = abs(b.y - a.y);  // height
+  bool low = h < w;  // step along x if true, otherwise along y
+  // like drawLineLow/High, start from the end with the smaller x (or y)
+  bool swap = low ? (a.x > b.x) : (a.y > b.y);
+  const Vertex& p = swap ? b : a;
+  const Vertex& q = swap ? a : b;
+  int steps = low ? w : h;
+  // colors in 16.16 fixed point, starting half a step up so that the
+  // integer part is the rounded color
+  int r = (p.color.r << 16) + 0x8000;
+  int g = (p.color.g << 16) + 0x8000;
+  int bl = (p.color.b << 16) + 0x8000;
+  int al = (p.alpha << 16) + 0x8000;
+  int dr = 0;
+  int dg = 0;
+  int db = 0;
+  int da = 0;
+  if (steps > 0) {
+    dr = ((q.color.r - p.color.r) * 65536) / steps;
+    dg = ((q.color.g - p.color.g) * 65536) / steps;
+    db = ((q.color.b - p.color.b) * 65536) / steps;
+    da = ((q.alpha - p.alpha) * 65536) / steps;
+  }
+  bool opaque = p.alpha == 255 && q.alpha == 255;
+  Pixel* pixels = (Pixel*) _canvas.data();
+  int width = _canvas.width();
+  if (h == 0 || w == 0) {
+    // horizontal or vertical: a direct row or column span
+    int start = low ? max(p.x, clip.xmin) : max(p.y, clip.ymin);
+    int stop = low ? min(q.x, clip.xmax) : min(q.y, clip.ymax);
+    int other = low ? p.y : p.x;  // fixed row or column
+    if ((low && (other < clip.ymin || other > clip.ymax)) ||
+        (!low && (other < clip.xmin || other > clip.xmax))) {
+      return;
+    }
+    Pixel* pixel = low ? pixels + other * width + start :
+        pixels + start * width + other;
+    if (low && dr == 0 && dg == 0 && db == 0 && da == 0) {
+      // solid horizontal line; the skipped steps are always ends
+      int first = start + (start == skip0 || start == skip1);
+      int last = stop - (stop == skip0 || stop == skip1);
+      if (first <= last) {
+        _canvas.blendSpan(other, first, last, p.color, p.alpha);
       }
-      drawLineLow(a, b);
-    } else {
-      if (a.y > b.y) {
-        // swap a and b
-        Vertex temp = b;
-        b = a;
-        a = temp;
+      return;
+    }
+    int stride = low ? 1 : width;
+    int skipped = start - (low ? p.x : p.y);
+    r += skipped * dr;
+    g += skipped * dg;
+    bl += skipped * db;
+    al += skipped * da;
+    for (int i = start; i <= stop; i++) {
+      Pixel c = {(unsigned char) (r >> 16), (unsigned char) (g >> 16),
+          (unsigned char) (bl >> 16)};
+      if (opaque) {
+        *pixel = c;
+      } else if (i != skip0 && i != skip1) {
+        blendOver(*pixel, c, al >> 16);
+      }
+      pixel += stride;
+      r += dr;
+      g += dg;
+      bl += db;
+      al += da;
+    }
+    return;
+  }
+  // Bresenham's along the major axis, same decisions as drawLineLow/High
+  int minor = low ? ((q.y > p.y) ? 1 : -1) : ((q.x > p.x) ? 1 : -1);
+  int major = low ? w : h;
+  int across = low ? h : w;
+  int F = (2 * across) - major;
+  int x = p.x;
+  int y = p.y;
+  int end = low ? min(q.x, clip.xmax) : min(q.y, clip.ymax);
+  for (int i = low ? x : y; i <= end; i++) {
+    if (i != skip0 && i != skip1 && x >= clip.xmin && x <= clip.xmax &&
+        y >= clip.ymin && y <= clip.ymax) {
+      Pixel c = {(unsigned char) (r >> 16), (unsigned char) (g >> 16),
+          (unsigned char) (bl >> 16)};
+      if (opaque) {
+        pixels[y * width + x] = c;
+      } else {
+        blendOver(pixels[y * width + x], c, al >> 16);
+      }
+    }
+    r += dr;
+    g += dg;
+    bl += db;
+    al += da;
+    if (F > 0) {
+      if (low) {
+        y += minor;
+      } else {
+        x += minor;
       }
-      drawLineHigh(a, b);
+      F += 2 * (across - major);
+    } else {
+      F += 2 * across;
+    }
+    if (low) {
+      x++;
+    } else {
+      y++;
     }
   }
 }
 
-void Canvas::drawLineLow(Vertex& a, Vertex& b) {
+void Canvas::drawLineLow(Vertex& a, Vertex& b, int skip0, int skip1,
+    const Rect& clip) {
   int y = a.y;
   int w = b.x - a.x;  // width
   int h = b.y - a.y;  // height
@@ -139,9 +676,15 @@ void Canvas::drawLineLow(Vertex& a, Vertex& b) {
     h *= -1;
   }
   int F = (2 * h) - w;
-  for (int x = a.x; x <= b.x; x++) {
+  int xend = min(b.x, clip.xmax);  // x only increases, stop past the clip
+  for (int x = a.x; x <= xend; x++) {
     // y = row i, x = col j
-    _canvas.set(y, x, interpolLinear(a, b, x, y));
+    if (x != skip0 && x != skip1 && x >= clip.xmin && y >= clip.ymin &&
+        y <= clip.ymax) {
+      int alpha;
+      Pixel c = interpolLinear(a, b, x, y, &alpha);
+      plot(y, x, c, alpha);
+    }
     if (F > 0) {
       y += dy;
       F += 2 * (h - w);
@@ -151,7 +694,8 @@ void Canvas::drawLineLow(Vertex& a, Vertex& b) {
   }
 }
 
-void Canvas::drawLineHigh(Vertex& a, Vertex& b) {
+void Canvas::drawLineHigh(Vertex& a, Vertex& b, int skip0, int skip1,
+    const Rect& clip) {
   int x = a.x;
   int w = b.x - a.x;  // width
   int h = b.y - a.y;  // height
@@ -161,9 +705,15 @@ void Canvas::drawLineHigh(Vertex& a, Vertex& b) {
     w *= -1;
   }
   int F = (2 * w) - h;
-  for (int y = a.y; y <= b.y; y++) {
+  int yend = min(b.y, clip.ymax);  // y only increases, stop past the clip
+  for (int y = a.y; y <= yend; y++) {
     // y = row i, x = col j
-    _canvas.set(y, x, interpolLinear(a, b, x, y));
+    if (y != skip0 && y != skip1 && y >= clip.ymin && x >= clip.xmin &&
+        x <= clip.xmax) {
+      int alpha;
+      Pixel c = interpolLinear(a, b, x, y, &alpha);
+      plot(y, x, c, alpha);
+    }
     if (F > 0) {
       x += dx;
       F += 2 * (w - h);
@@ -173,13 +723,73 @@ void Canvas::drawLineHigh(Vertex& a, Vertex& b) {
   }
 }
 
+void Canvas::drawLineSmooth(const Vertex& a, const Vertex& b, bool joined,
+    bool closing, const Rect& clip) {
+  float ax = a.x + a.fx;
+  float ay = a.y + a.fy;
+  float bx = b.x + b.fx;
+  float by = b.y + b.fy;
+  bool steep = fabs(by - ay) > fabs(bx - ax);
+  // u is the major axis, v the minor one
+  float u0 = steep ? ay : ax;
+  float v0 = steep ? ax : ay;
+  float u1 = steep ? by : bx;
+  float v1 = steep ? bx : by;
+  const Vertex* p = &a;
+  const Vertex* q = &b;
+  if (u0 > u1) {
+    swap(u0, u1);
+    swap(v0, v1);
+    swap(p, q);
+  }
+  float du = u1 - u0;
+  float gradient = (du > 0) ? (v1 - v0) / du : 0;
+  // the previous line of a curve already covered the step holding a, and
+  // the first line of a closed outline the step holding b
+  int skip0 = joined ? (int) floor((steep ? ay : ax) + 0.5f) : INT_MIN;
+  int skip1 = closing ? (int) floor((steep ? by : bx) + 0.5f) : INT_MIN;
+  // every step from the pixel holding one end to the pixel holding the
+  // other, so the end pixels are covered like in the aliased lines
+  int start = max((int) floor(u0 + 0.5f), steep ? clip.ymin : clip.xmin);
+  int stop = min((int) floor(u1 + 0.5f), steep ? clip.ymax : clip.xmax);
+  int vmin = steep ? clip.xmin : clip.ymin;
+  int vmax = steep ? clip.xmax : clip.ymax;
+  Pixel* pixels = (Pixel*) _canvas.data();
+  int width = _canvas.width();
+  for (int u = start; u <= stop; u++) {
+    if (u == skip0 || u == skip1) {
+      continue;
+    }
+    float v = v0 + gradient * (u - u0);
+    float t = (du > 0) ? min(max((u - u0) / du, 0.0f), 1.0f) : 0;
+    Pixel c = {(unsigned char) (p->color.r + (q->color.r - p->color.r) * t +
+        0.5f), (unsigned char) (p->color.g + (q->color.g - p->color.g) * t +
+        0.5f), (unsigned char) (p->color.b + (q->color.b - p->color.b) * t +
+        0.5f)};
+    float alpha = p->alpha + (q->alpha - p->alpha) * t;
+    int below = (int) floor(v);
+    float frac = v - below;  // share of the step on the pixel after below
+    if (below >= vmin && below <= vmax) {
+      int x = steep ? below : u;
+      int y = steep ? u : below;
+      blendCoverage(pixels[y * width + x], c, alpha * (1 - frac));
+    }
+    if (below + 1 >= vmin && below + 1 <= vmax) {
+      int x = steep ? below + 1 : u;
+      int y = steep ? u : below + 1;
+      blendCoverage(pixels[y * width + x], c, alpha * frac);
+    }
+  }
+}
+
 void Canvas::drawTriangles() {
   int numTriangles = _vertices.size() / 3;
   for (int i = 0; i < numTriangles; i++) {
     if (_vertices[i * 3].fill) {
       // first vertex's fill property determines fill for entire triangle
-      drawTriangleFill(_vertices[i * 3], _vertices[i * 3 + 1],
-          _vertices[i * 3 + 2]);
+      Shape triangle = {TRIANGLES,
+          {_vertices[i * 3], _vertices[i * 3 + 1], _vertices[i * 3 + 2]}};
+      emit(triangle);
     } else {
       drawTriangleNoFill(_vertices[i * 3], _vertices[i * 3 + 1],
           _vertices[i * 3 + 2]);
@@ -188,15 +798,181 @@ void Canvas::drawTriangles() {
 }
 
 void Canvas::drawTriangleFill(const Vertex& p0, const Vertex& p1,
-    const Vertex& p2) {
+    const Vertex& p2, const Rect& clip) {
   // compute min and max among 3 vertices, i.e. bounding box
-  int xmin = min(min(p0.x, p1.x), p2.x);
-  int xmax = max(max(p0.x, p1.x), p2.x);
-  int ymin = min(min(p0.y, p1.y), p2.y);
-  int ymax = max(max(p0.y, p1.y), p2.y);
+  int xmin = max(min(min(p0.x, p1.x), p2.x), clip.xmin);
+  int xmax = min(max(max(p0.x, p1.x), p2.x), clip.xmax);
+  int ymin = max(min(min(p0.y, p1.y), p2.y), clip.ymin);
+  int ymax = min(max(max(p0.y, p1.y), p2.y), clip.ymax);
+  if (xmin > xmax || ymin > ymax) {
+    return;
+  }
+  if (_canvas.width() > 4096 || _canvas.height() > 4096) {
+    // edge function products no longer fit exactly in a float
+    Rect box = {xmin, ymin, xmax, ymax};
+    drawTriangleFillImplicit(p0, p1, p2, box);
+    return;
+  }
+  float f[3] = {implicit(p1, p2, p0.x, p0.y), implicit(p2, p0, p1.x, p1.y),
+      implicit(p0, p1, p2.x, p2.y)};
+  if (f[0] == 0 || f[1] == 0 || f[2] == 0) {
+    return;  // degenerate triangle, no pixel has all barycentrics >= 0
+  }
+  // edge k runs from a[k] to b[k] and is opposite vertex k
+  const Vertex* a[3] = {&p1, &p2, &p0};
+  const Vertex* b[3] = {&p2, &p0, &p1};
+  int stepX[3];  // change in edge function per column
+  int stepY[3];  // change in edge function per row
+  int bias[3];  // 0 if this triangle owns pixels on edge k, otherwise 1
+  float denom[3];  // |f|, so barycentric = edge function / denom
+  int origin[3];  // edge function at (xmin, ymin)
+  for (int k = 0; k < 3; k++) {
+    // flip each edge function so pixels inside the triangle are positive
+    int sign = (f[k] > 0) ? 1 : -1;
+    stepX[k] = sign * (b[k]->y - a[k]->y);
+    stepY[k] = -sign * (b[k]->x - a[k]->x);
+    origin[k] = stepX[k] * (xmin - a[k]->x) + stepY[k] * (ymin - a[k]->y);
+    denom[k] = sign * f[k];
+    // use (-5, -1.1) as offscreen comparator point
+    bias[k] = (f[k] * implicit(*a[k], *b[k], -5, -1.1) > 0) ? 0 : 1;
+  }
+  // a pixel is covered when edge[k] >= bias[k] for every edge, which is the
+  // same as barycentric > 0, or == 0 on an edge this triangle owns
+  auto edgeAt = [&](int k, int x, int y) {
+    return origin[k] + stepX[k] * (x - xmin) + stepY[k] * (y - ymin);
+  };
+  // translucent triangles blend each pixel, interpolating alpha unless it
+  // is the same at every corner
+  bool flat = p0.alpha == p1.alpha && p1.alpha == p2.alpha;
+  bool opaque = flat && p0.alpha == 255;
+  Pixel* pixels = (Pixel*) _canvas.data();
+  const int blockSize = 8;
+  for (int by = ymin; by <= ymax; by += blockSize) {
+    int byEnd = min(by + blockSize - 1, ymax);
+    for (int bx = xmin; bx <= xmax; bx += blockSize) {
+      int bxEnd = min(bx + blockSize - 1, xmax);
+      // edge functions are linear, so their extremes are at block corners
+      bool outside = false;
+      bool inside = true;
+      for (int k = 0; k < 3; k++) {
+        int c0 = edgeAt(k, bx, by);
+        int c1 = edgeAt(k, bxEnd, by);
+        int c2 = edgeAt(k, bx, byEnd);
+        int c3 = edgeAt(k, bxEnd, byEnd);
+        if (max(max(c0, c1), max(c2, c3)) < bias[k]) {
+          outside = true;
+        }
+        if (min(min(c0, c1), min(c2, c3)) < bias[k]) {
+          inside = false;
+        }
+      }
+      if (outside) {
+        continue;
+      }
+      for (int y = by; y <= byEnd; y++) {
+        Pixel* row = pixels + y * _canvas.width();
+        int e0 = edgeAt(0, bx, y);
+        int e1 = edgeAt(1, bx, y);
+        int e2 = edgeAt(2, bx, y);
+        int x = bx;
+#ifdef AGL_SSE2
+        // lanes hold e + lane * stepX for the next 4 columns
+        __m128i v0 = _mm_add_epi32(_mm_set1_epi32(e0), _mm_setr_epi32(0,
+            stepX[0], 2 * stepX[0], 3 * stepX[0]));
+        __m128i v1 = _mm_add_epi32(_mm_set1_epi32(e1), _mm_setr_epi32(0,
+            stepX[1], 2 * stepX[1], 3 * stepX[1]));
+        __m128i v2 = _mm_add_epi32(_mm_set1_epi32(e2), _mm_setr_epi32(0,
+            stepX[2], 2 * stepX[2], 3 * stepX[2]));
+        __m128i step0 = _mm_set1_epi32(4 * stepX[0]);
+        __m128i step1 = _mm_set1_epi32(4 * stepX[1]);
+        __m128i step2 = _mm_set1_epi32(4 * stepX[2]);
+        __m128i limit0 = _mm_set1_epi32(bias[0] - 1);
+        __m128i limit1 = _mm_set1_epi32(bias[1] - 1);
+        __m128i limit2 = _mm_set1_epi32(bias[2] - 1);
+        __m128 d0 = _mm_set1_ps(denom[0]);
+        __m128 d1 = _mm_set1_ps(denom[1]);
+        __m128 d2 = _mm_set1_ps(denom[2]);
+        for (; x + 3 <= bxEnd; x += 4) {
+          int covered = 0xF;
+          if (!inside) {
+            __m128i in = _mm_and_si128(_mm_cmpgt_epi32(v0, limit0),
+                _mm_and_si128(_mm_cmpgt_epi32(v1, limit1),
+                _mm_cmpgt_epi32(v2, limit2)));
+            covered = _mm_movemask_ps(_mm_castsi128_ps(in));
+          }
+          if (covered != 0) {
+            // same float operations, in the same order, as interpolGouraud
+            __m128 alpha = _mm_div_ps(_mm_cvtepi32_ps(v0), d0);
+            __m128 beta = _mm_div_ps(_mm_cvtepi32_ps(v1), d1);
+            __m128 gamma = _mm_div_ps(_mm_cvtepi32_ps(v2), d2);
+            alignas(16) int r[4], g[4], bl[4];
+            _mm_store_si128((__m128i*) r, _mm_cvttps_epi32(_mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(p0.color.r)),
+                _mm_mul_ps(beta, _mm_set1_ps(p1.color.r))),
+                _mm_mul_ps(gamma, _mm_set1_ps(p2.color.r)))));
+            _mm_store_si128((__m128i*) g, _mm_cvttps_epi32(_mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(p0.color.g)),
+                _mm_mul_ps(beta, _mm_set1_ps(p1.color.g))),
+                _mm_mul_ps(gamma, _mm_set1_ps(p2.color.g)))));
+            _mm_store_si128((__m128i*) bl, _mm_cvttps_epi32(_mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(p0.color.b)),
+                _mm_mul_ps(beta, _mm_set1_ps(p1.color.b))),
+                _mm_mul_ps(gamma, _mm_set1_ps(p2.color.b)))));
+            alignas(16) int a[4] = {p0.alpha, p0.alpha, p0.alpha, p0.alpha};
+            if (!flat) {
+              _mm_store_si128((__m128i*) a, _mm_cvttps_epi32(_mm_add_ps(
+                  _mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(p0.alpha)),
+                  _mm_mul_ps(beta, _mm_set1_ps(p1.alpha))),
+                  _mm_mul_ps(gamma, _mm_set1_ps(p2.alpha)))));
+            }
+            for (int i = 0; i < 4; i++) {
+              if (covered & (1 << i)) {
+                Pixel c = {(unsigned char) r[i], (unsigned char) g[i],
+                    (unsigned char) bl[i]};
+                if (opaque) {
+                  row[x + i] = c;
+                } else {
+                  blendOver(row[x + i], c, min(a[i], 255));
+                }
+              }
+            }
+          }
+          v0 = _mm_add_epi32(v0, step0);
+          v1 = _mm_add_epi32(v1, step1);
+          v2 = _mm_add_epi32(v2, step2);
+        }
+        e0 += (x - bx) * stepX[0];
+        e1 += (x - bx) * stepX[1];
+        e2 += (x - bx) * stepX[2];
+#endif
+        for (; x <= bxEnd; x++) {
+          if (inside || (e0 >= bias[0] && e1 >= bias[1] && e2 >= bias[2])) {
+            float alpha = e0 / denom[0];
+            float beta = e1 / denom[1];
+            float gamma = e2 / denom[2];
+            Pixel c = interpolGouraud(p0, p1, p2, alpha, beta, gamma);
+            if (opaque) {
+              row[x] = c;
+            } else {
+              int a = flat ? p0.alpha :
+                  alpha * p0.alpha + beta * p1.alpha + gamma * p2.alpha;
+              blendOver(row[x], c, min(a, 255));
+            }
+          }
+          e0 += stepX[0];
+          e1 += stepX[1];
+          e2 += stepX[2];
+        }
+      }
+    }
+  }
+}
+
+void Canvas::drawTriangleFillImplicit(const Vertex& p0, const Vertex& p1,
+    const Vertex& p2, const Rect& box) {
   // iterate over bounding box
-  for (int y = ymin; y <= ymax; y++) {
-    for (int x = xmin; x <= xmax; x++) {
+  for (int y = box.ymin; y <= box.ymax; y++) {
+    for (int x = box.xmin; x <= box.xmax; x++) {
       // compute barycentric coordinates
       float fAlpha = implicit(p1, p2, p0.x, p0.y);
       float fBeta = implicit(p2, p0, p1.x, p1.y);
@@ -211,7 +987,10 @@ void Canvas::drawTriangleFill(const Vertex& p0, const Vertex& p1,
             (gamma > 0 || (fGamma * implicit(p0, p1, -5, -1.1)) > 0)) {
           // point is inside or on edge that this triangle owns
           // y = col j, x = row i
-          _canvas.set(y, x, interpolGouraud(p0, p1, p2, alpha, beta, gamma));
+          int a = (p0.alpha == p1.alpha && p1.alpha == p2.alpha) ? p0.alpha :
+              alpha * p0.alpha + beta * p1.alpha + gamma * p2.alpha;
+          plot(y, x, interpolGouraud(p0, p1, p2, alpha, beta, gamma),
+              min(a, 255));
         }
       }
     }
@@ -227,35 +1006,197 @@ void Canvas::drawTriangleNoFill(const Vertex& p0, const Vertex& p1,
   points.push_back(p2);
   points.push_back(p2);
   points.push_back(p0);
-  drawLines(points);
+  drawLines(points, true, true);
 }
 
 void Canvas::drawCircles() {
   for (int i = 0; i < _vertices.size(); i++) {
-    if (_vertices[i].fill) {
-      drawCircleFill(_vertices[i]);
+    if (_vertices[i].fill || _circleOutline == CIRCLE_MIDPOINT) {
+      Shape circle = {CIRCLES, {_vertices[i]}};
+      emit(circle);
     } else {
       drawCircleNoFill(_vertices[i]);
     }
   }
 }
 
-void Canvas::drawCircleFill(const Vertex& center) {
-  int startRow = center.y - center.radius;
-  int endRow = center.y + center.radius;
-  int startCol = center.x - center.radius;
-  int endCol = center.x + center.radius;
-  Vertex a = {startCol, startRow, 0, 0, 0, center.color, false};
-  Vertex b = {endCol, endRow, 0, 0, 0, center.color, false};
-  clamp(a);
-  clamp(b);
-  for (int y = a.y; y <= b.y; y++) {
-    for (int x = a.x; x <= b.x; x++) {
-      int distance = sqrt(pow(x - center.x, 2) + pow(y - center.y, 2));
-      if (distance <= center.radius) {
-        _canvas.set(y, x, center.color);
+void Canvas::drawCircleFill(const Vertex& center, const Rect& clip) {
+  int r = center.radius;
+  if (r < 0) {
+    return;
+  }
+  // a pixel is covered when its truncated distance is at most r, i.e.
+  // dx^2 + dy^2 < (r + 1)^2, so each row is one span of half-width
+  // floor(sqrt(limit - dy^2))
+  int limit = (r + 1) * (r + 1) - 1;
+  int ymin = max(max(center.y - r, 0), clip.ymin);
+  int ymax = min(min(center.y + r, _canvas.height() - 1), clip.ymax);
+  int xmin = max(0, clip.xmin);
+  int xmax = min(_canvas.width() - 1, clip.xmax);
+  int half = 0;  // half-width of the span, adjusted from the previous row
+  for (int y = ymin; y <= ymax; y++) {
+    int dy = y - center.y;
+    int rowLimit = limit - dy * dy;
+    while ((half + 1) * (half + 1) <= rowLimit) {
+      half++;
+    }
+    while (half * half > rowLimit) {
+      half--;
+    }
+    int x0 = max(center.x - half, xmin);
+    int x1 = min(center.x + half, xmax);
+    if (x0 <= x1) {
+      _canvas.blendSpan(y, x0, x1, center.color, center.alpha);
+    }
+  }
+}
+
+void Canvas::drawCircleOutline(const Vertex& center, const Rect& clip) {
+  Pixel* pixels = (Pixel*) _canvas.data();
+  int width = _canvas.width();
+  // write pixel (cx + dx, cy + dy) if it lies inside the clip
+  auto plot = [&](int dx, int dy) {
+    int x = center.x + dx;
+    int y = center.y + dy;
+    if (x >= clip.xmin && x <= clip.xmax && y >= clip.ymin &&
+        y <= clip.ymax) {
+      if (center.alpha == 255) {
+        pixels[y * width + x] = center.color;
+      } else {
+        blendOver(pixels[y * width + x], center.color, center.alpha);
+      }
+    }
+  };
+  // plot (dx, dy) mirrored across both axes, once per distinct pixel so a
+  // translucent outline is not blended twice where the mirrors meet
+  auto plot4 = [&](int dx, int dy) {
+    plot(dx, dy);
+    if (dx != 0) {
+      plot(-dx, dy);
+    }
+    if (dy != 0) {
+      plot(dx, -dy);
+      if (dx != 0) {
+        plot(-dx, -dy);
       }
     }
+  };
+  // walk the octant from (r, 0) to the diagonal and mirror it 8 ways
+  int x = center.radius;
+  int y = 0;
+  int F = 1 - center.radius;  // midpoint decision variable
+  while (x >= y) {
+    plot4(x, y);
+    if (x != y) {
+      plot4(y, x);
+    }
+    y++;
+    if (F < 0) {
+      F += 2 * y + 1;
+    } else {
+      x--;
+      F += 2 * (y - x) + 1;
+    }
+  }
+}
+
+void Canvas::drawCircleFillSmooth(const Vertex& center, const Rect& clip) {
+  int r = center.radius;
+  if (r < 0) {
+    return;
+  }
+  Pixel* pixels = (Pixel*) _canvas.data();
+  int width = _canvas.width();
+  // pixels are fully covered up to distance r and partly up to r + 1, which
+  // keeps the disc inside the pixels the aliased disc touches
+  int inner = r * r;
+  int outer = (r + 1) * (r + 1) - 1;
+  int ymin = max(center.y - r, clip.ymin);
+  int ymax = min(center.y + r, clip.ymax);
+  for (int y = ymin; y <= ymax; y++) {
+    int dy = y - center.y;
+    // half-widths of the full span and of the partly covered one
+    int full = (inner >= dy * dy) ? (int) sqrt((float) (inner - dy * dy)) :
+        -1;
+    int part = (int) sqrt((float) (outer - dy * dy));
+    while (full >= 0 && full * full + dy * dy > inner) {
+      full--;
+    }
+    while ((full + 1) * (full + 1) + dy * dy <= inner) {
+      full++;
+    }
+    while (part * part + dy * dy > outer) {
+      part--;
+    }
+    while ((part + 1) * (part + 1) + dy * dy <= outer) {
+      part++;
+    }
+    if (full >= 0) {
+      int x0 = max(center.x - full, clip.xmin);
+      int x1 = min(center.x + full, clip.xmax);
+      if (x0 <= x1) {
+        _canvas.blendSpan(y, x0, x1, center.color, center.alpha);
+      }
+    }
+    // the edge pixels on both sides of the full span
+    for (int dx = full + 1; dx <= part; dx++) {
+      float coverage = r + 1 - sqrt((float) (dx * dx + dy * dy));
+      float opacity = center.alpha * coverage;
+      if (center.x - dx >= clip.xmin && center.x - dx <= clip.xmax) {
+        blendCoverage(pixels[y * width + center.x - dx], center.color,
+            opacity);
+      }
+      if (center.x + dx >= clip.xmin && center.x + dx <= clip.xmax) {
+        blendCoverage(pixels[y * width + center.x + dx], center.color,
+            opacity);
+      }
+    }
+  }
+}
+
+void Canvas::drawCircleOutlineSmooth(const Vertex& center,
+    const Rect& clip) {
+  int r = center.radius;
+  if (r < 0) {
+    return;
+  }
+  Pixel* pixels = (Pixel*) _canvas.data();
+  int width = _canvas.width();
+  // the ring covers pixels at distances strictly between r - 1 and r + 1;
+  // each row has one run of them, or two split by the pixels within r - 1
+  int inner = (r - 1) * (r - 1);
+  int outer = (r + 1) * (r + 1) - 1;
+  int ymin = max(center.y - r, clip.ymin);
+  int ymax = min(center.y + r, clip.ymax);
+  for (int y = ymin; y <= ymax; y++) {
+    int dy = y - center.y;
+    int hole = (r > 0 && inner >= dy * dy) ?
+        (int) sqrt((float) (inner - dy * dy)) : -1;
+    int part = (int) sqrt((float) (outer - dy * dy));
+    while (hole >= 0 && hole * hole + dy * dy > inner) {
+      hole--;
+    }
+    while (r > 0 && (hole + 1) * (hole + 1) + dy * dy <= inner) {
+      hole++;
+    }
+    while (part * part + dy * dy > outer) {
+      part--;
+    }
+    while ((part + 1) * (part + 1) + dy * dy <= outer) {
+      part++;
+    }
+    int x0 = max(center.x - part, clip.xmin);
+    int x1 = min(center.x + part, clip.xmax);
+    for (int x = x0; x <= x1; x++) {
+      int dx = x - center.x;
+      if (abs(dx) <= hole) {
+        x = min(center.x + hole, x1);  // skip the pixels inside the ring
+        continue;
+      }
+      float coverage = 1 - fabs(sqrt((float) (dx * dx + dy * dy)) - r);
+      blendCoverage(pixels[y * width + x], center.color,
+          center.alpha * coverage);
+    }
   }
 }
 
@@ -273,94 +1214,201 @@ void Canvas::drawCircleNoFill(const Vertex& center) {
       a.y = round(cy + (r * sin(theta)));
       b.x = round(cx + (r * cos(theta + delta)));
       b.y = round(cy + (r * sin(theta + delta)));
+      // keep the exact points for antialiased lines
+      a.fx = (cx + (r * cos(theta))) - a.x;
+      a.fy = (cy + (r * sin(theta))) - a.y;
+      b.fx = (cx + (r * cos(theta + delta))) - b.x;
+      b.fy = (cy + (r * sin(theta + delta))) - b.y;
       a.color = color;
       b.color = color;
+      a.alpha = center.alpha;
+      b.alpha = center.alpha;
       clamp(a);
       clamp(b);
       points.push_back(a);
       points.push_back(b);
     }
-    drawLines(points);
+    drawLines(points, true);
+}
+
+namespace {
+  // sin and cos of every whole degree, shared by all canvases and filled
+  // the first time a curve is drawn
+  struct DegreeTable {
+    double cosine[360];
+    double sine[360];
+    DegreeTable() {
+      for (int i = 0; i < 360; i++) {
+        cosine[i] = cos(i * (M_PI / 180));
+        sine[i] = sin(i * (M_PI / 180));
+      }
+    }
+  };
+
+  const DegreeTable& degreeTable() {
+    static const DegreeTable table;
+    return table;
+  }
+
+  // reduce an angle in whole degrees to [0, 360)
+  int wrapDegrees(long long degrees) {
+    int wrapped = degrees % 360;
+    return (wrapped < 0) ? wrapped + 360 : wrapped;
+  }
+}
+
+Vertex Canvas::curvePoint(const Vertex& center, double r, int degrees) {
+  const DegreeTable& table = degreeTable();
+  double x = center.x + (r * table.cosine[degrees]);
+  double y = center.y + (r * table.sine[degrees]);
+  Vertex p = {(int) round(x), (int) round(y), 0, 0, 0, center.color, false,
+      center.alpha};
+  p.fx = x - p.x;
+  p.fy = y - p.y;
+  clamp(p);
+  return p;
 }
 
 void Canvas::drawRoses() {
+  const DegreeTable& table = degreeTable();
   for (int i = 0; i < _vertices.size(); i++) {
-    int cx = _vertices[i].x;  // center x
-    int cy = _vertices[i].y;  // center y
-    int amp = _vertices[i].radius;
-    int n = _vertices[i].n;
-    int d = _vertices[i].d;
-    Pixel color = _vertices[i].color;
-    vector<Vertex> points;
-    // use 361 * d points to approximate the rose curve
-    for (int j = 0; j < 361 * d; j++) {
-      Vertex a, b;
-      // multiply by angular frequency n/d and convert degrees to radians
-      float theta = j * (M_PI / 180);
-      float nextTheta = (j + 1) * (M_PI / 180);
-      float rad = (j * ((float) n / d)) * (M_PI / 180);
-      float nextRad = ((j + 1) * ((float) n / d)) * (M_PI / 180);
-      float r = amp * cos(rad);
-      float nextR = amp * cos(nextRad);
-      a.x = round(cx + (r * cos(theta)));
-      a.y = round(cy + (r * sin(theta)));
-      b.x = round(cx + (nextR * cos(nextTheta)));
-      b.y = round(cy + (nextR * sin(nextTheta)));
-      a.color = color;
-      b.color = color;
-      clamp(a);
-      clamp(b);
-      points.push_back(a);
-      points.push_back(b);
+    const Vertex& center = _vertices[i];
+    if (_curveTolerance > 0) {
+      drawRoseAdaptive(center);
+      continue;
+    }
+    int amp = center.radius;
+    int n = center.n;
+    int d = center.d;
+    // theta advances 1 degree per point and k * theta advances n / d
+    // degrees; k * theta is read from the table whenever it is a whole
+    // degree and rotated by the n / d step in between
+    double stepCos = cos(n * M_PI / (180.0 * d));
+    double stepSin = sin(n * M_PI / (180.0 * d));
+    double kCos = 1;  // cos(k * theta)
+    double kSin = 0;  // sin(k * theta)
+    Vertex a = curvePoint(center, amp, 0);
+    // use 361 * d segments to approximate the rose curve, computing each
+    // point once and sending each segment straight to the rasterizer
+    for (int j = 1; j <= 361 * d; j++) {
+      long long kDegrees = (long long) j * n;  // k * theta, in 1/d degrees
+      if (kDegrees % d == 0) {
+        int index = wrapDegrees(kDegrees / d);
+        kCos = table.cosine[index];
+        kSin = table.sine[index];
+      } else {
+        double c = (kCos * stepCos) - (kSin * stepSin);
+        kSin = (kSin * stepCos) + (kCos * stepSin);
+        kCos = c;
+      }
+      Vertex b = curvePoint(center, amp * kCos, j % 360);
+      Shape line = {LINES, {a, b}};
+      line.joined = j > 1;
+      emit(line);
+      a = b;
     }
-    drawLines(points);
+  }
+}
+
+void Canvas::drawRoseAdaptive(const Vertex& center) {
+  if (center.d <= 0) {
+    return;  // no sweep, like the 361 * d fixed steps
+  }
+  double amp = abs(center.radius);
+  double k = (double) center.n / center.d;
+  double total = 361 * center.d * (M_PI / 180);  // same sweep as 361 * d
+  // P(theta) = r (cos theta, sin theta) with r = amp cos(k theta) has
+  // |P''| = amp sqrt(((k^2 + 1) cos(k theta))^2 + (2k sin(k theta))^2),
+  // and a chord over an angle h strays at most |P''| h^2 / 8 from the
+  // curve, so each step takes the largest h that keeps that under the
+  // tolerance for the larger curvature of its two ends
+  auto curvature = [&](double kCos, double kSin) {
+    double u = (k * k + 1) * kCos;
+    double v = 2 * k * kSin;
+    return amp * sqrt(u * u + v * v);
+  };
+  auto stepFor = [&](double bend) {
+    return bend > 0 ? sqrt(8 * _curveTolerance / bend) : total;
+  };
+  Vertex a = curvePoint(center, center.radius, 0);
+  bool drawn = false;
+  double theta = 0;
+  double bend = curvature(1, 0);  // at theta = 0
+  while (theta < total) {
+    double guess = min(theta + stepFor(bend), total);
+    double ahead = curvature(cos(k * guess), sin(k * guess));
+    theta = min(theta + stepFor(max(bend, ahead)), total);
+    double kCos = cos(k * theta);
+    double kSin = sin(k * theta);
+    bend = curvature(kCos, kSin);
+    double r = center.radius * kCos;
+    double x = center.x + (r * cos(theta));
+    double y = center.y + (r * sin(theta));
+    Vertex b = {(int) round(x), (int) round(y), 0, 0, 0, center.color, false,
+        center.alpha};
+    b.fx = x - b.x;
+    b.fy = y - b.y;
+    clamp(b);
+    if (b.x == a.x && b.y == a.y) {
+      continue;  // same pixel as the last point, nothing new to draw
+    }
+    Shape line = {LINES, {a, b}};
+    line.joined = drawn;
+    emit(line);
+    a = b;
+    drawn = true;
+  }
+  if (!drawn) {
+    // the whole curve rounds to one pixel
+    Shape dot = {LINES, {a, a}};
+    emit(dot);
   }
 }
 
 void Canvas::drawMaurers() {
+  const DegreeTable& table = degreeTable();
   for (int i = 0; i < _vertices.size(); i++) {
-    int cx = _vertices[i].x;  // center x
-    int cy = _vertices[i].y;  // center y
-    int amp = _vertices[i].radius;
-    int n = _vertices[i].n;
-    int d = _vertices[i].d;
-    Pixel color = _vertices[i].color;
-    vector<Vertex> points;
+    const Vertex& center = _vertices[i];
+    int amp = center.radius;
+    int n = center.n;
+    int d = center.d;
+    // point j is at theta = j * d degrees with r = amp * cos(n * theta),
+    // both whole degrees, so every value comes from the table
+    Vertex a = curvePoint(center, amp, 0);
     // draw lines to connect the 361 points on the rose curve
-    for (int j = 0; j < 361; j++) {
-      Vertex a, b;
-      // multiply by angular frequency n/d and convert degrees to radians
-      float k = j * d;
-      float nextK = (j + 1) * d;
-      float theta = k * (M_PI / 180);
-      float nextTheta = nextK * (M_PI / 180);
-      float rad = n * k * (M_PI / 180);
-      float nextRad = n * nextK * (M_PI / 180);
-      float r = amp * cos(rad);
-      float nextR = amp * cos(nextRad);
-      a.x = round(cx + (r * cos(theta)));
-      a.y = round(cy + (r * sin(theta)));
-      b.x = round(cx + (nextR * cos(nextTheta)));
-      b.y = round(cy + (nextR * sin(nextTheta)));
-      a.color = color;
-      b.color = color;
-      clamp(a);
-      clamp(b);
-      points.push_back(a);
-      points.push_back(b);
+    for (int j = 1; j <= 361; j++) {
+      long long theta = (long long) j * d;
+      double r = amp * table.cosine[wrapDegrees(theta * n)];
+      Vertex b = curvePoint(center, r, wrapDegrees(theta));
+      Shape line = {LINES, {a, b}};
+      line.joined = j > 1;
+      emit(line);
+      a = b;
     }
-    drawLines(points);
   }
 }
 
+void Canvas::plot(int y, int x, const Pixel& c, int alpha) {
+  if (alpha == 255) {
+    _canvas.set(y, x, c);
+    return;
+  }
+  Pixel* pixels = (Pixel*) _canvas.data();
+  blendOver(pixels[y * _canvas.width() + x], c, alpha);
+}
+
 Pixel Canvas::interpolLinear(const Vertex& p1, const Vertex& p2,
-    int x, int y) {
+    int x, int y, int* alpha) {
   float t = (sqrt(pow(x - p1.x, 2) + pow(y - p1.y, 2))) /
       (sqrt(pow(p2.x - p1.x, 2) + pow(p2.y - p1.y, 2)));
   struct Pixel c;
   c.r = p1.color.r * (1 - t) + p2.color.r * t;
   c.g = p1.color.g * (1 - t) + p2.color.g * t;
   c.b = p1.color.b * (1 - t) + p2.color.b * t;
+  if (alpha != NULL) {
+    *alpha = (p1.alpha == p2.alpha) ? p1.alpha :
+        (int) (p1.alpha * (1 - t) + p2.alpha * t);
+  }
   return c;
 }
 
@@ -379,14 +1427,19 @@ float Canvas::implicit(const Vertex& a, const Vertex& b, float px, float py) {
 }
 
 void Canvas::clamp(Vertex& v) {
+  // a clamped point lies on the edge pixel, without a subpixel offset
   if (v.x < 0) {
     v.x = 0;
+    v.fx = 0;
   } else if (v.x >= _canvas.width()) {
     v.x = _canvas.width() - 1;
+    v.fx = 0;
   }
   if (v.y < 0) {
     v.y = 0;
+    v.fy = 0;
   } else if (v.y >= _canvas.height()) {
     v.y = _canvas.height() - 1;
+    v.fy = 0;
   }
 }
\ No newline at end of file
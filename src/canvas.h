@@ -8,9 +8,12 @@
 #ifndef canvas_H_
 #define canvas_H_
 
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 #include "image.h"
+#include "save_queue.h"
 
 namespace agl {
 
@@ -18,6 +21,18 @@ namespace agl {
   // UNDEFINED = not ready to draw, not accepting vertices
   enum PrimitiveType {UNDEFINED, LINES, TRIANGLES, CIRCLES, ROSES, MAURERS};
 
+  // defines how colors are interpolated along a line
+  // LINE_FIXED_POINT = step each channel once per pixel in 16.16 fixed point
+  // LINE_DISTANCE = recompute each pixel's color from its distance to the
+  //     first endpoint (original, much slower)
+  enum LineShading {LINE_FIXED_POINT, LINE_DISTANCE};
+
+  // defines how unfilled circles are drawn
+  // CIRCLE_MIDPOINT = integer midpoint circle, one pixel per octant step
+  // CIRCLE_POLYLINE = about 1.5r line segments placed with cos/sin
+  //     (original), clamping points that fall off the canvas to its edges
+  enum CircleOutline {CIRCLE_MIDPOINT, CIRCLE_POLYLINE};
+
   // representation of vertex with coordinates and color
   struct Vertex {
     int x;  // column (on x-axis)
@@ -27,6 +42,79 @@ namespace agl {
     int d;  // used to calculate angular frequency k = n / d
     Pixel color;
     bool fill;  // true if shape should be filled, otherwise false
+    unsigned char alpha = 255;  // opacity, 0 = invisible, 255 = opaque
+    // offset of the exact point from (x, y), e.g. for points on a curve,
+    // so antialiased lines can place their ends between pixels
+    float fx = 0;
+    float fy = 0;
+  };
+
+  // rectangular region of pixels, bounds are inclusive
+  struct Rect {
+    int xmin;
+    int ymin;
+    int xmax;
+    int ymax;
+  };
+
+  // a single line, triangle, or circle produced by end(), ready to rasterize
+  // (rose curves are broken into LINES shapes before rasterizing, circles
+  // use the center's fill to choose between a disc and an outline)
+  struct Shape {
+    PrimitiveType type;  // LINES, TRIANGLES, or CIRCLES
+    Vertex v[3];  // endpoints (LINES), corners (TRIANGLES), center (CIRCLES)
+    bool antialias = false;  // set by end() from begin()
+    // line continuing the previous one from v[0], as in a curve; an
+    // antialiased line skips the pixel at v[0] so joints are blended once
+    bool joined = false;
+    // last line of a closed outline, ending where the first one starts; it
+    // skips the pixel at v[1] the same way
+    bool closing = false;
+  };
+
+  // shapes recorded once from begin()...end() calls and drawn again with
+  // Canvas::draw, skipping validation and curve tessellation
+  // (background() is not recorded, it still fills the canvas immediately)
+  // For example, the following records a grid and draws it every frame
+  // DisplayList grid;
+  // drawer.beginRecord(grid);
+  //    drawer.begin(LINES);
+  //    ...
+  //    drawer.end();
+  // drawer.endRecord();
+  // drawer.draw(grid);
+  class DisplayList {
+    public:
+      // Remove every recorded shape
+      void clear();
+
+      // Return the number of recorded shapes
+      int size() const;
+
+    private:
+      friend class Canvas;
+
+      // a shape stored without the Vertex fields it does not use
+      struct Record {
+        PrimitiveType type;
+        bool fill;  // circles only
+        bool antialias;
+        bool joined;  // lines only
+        bool closing;  // lines only
+        int radius;  // circles only
+        int x[3];
+        int y[3];
+        Pixel color[3];
+        unsigned char alpha[3];
+        float fx[2];  // lines only
+        float fy[2];
+      };
+      std::vector<Record> _records;
+
+      // store a shape emitted by Canvas::end()
+      void add(const Shape& shape);
+      // rebuild the shape stored at index i
+      Shape shape(int i) const;
   };
 
   class Canvas {
@@ -34,9 +122,43 @@ namespace agl {
       Canvas(int w, int h);
       virtual ~Canvas();
 
-      // Save to file
+      // Save to file (format from the extension, see ImageFormat)
       void save(const std::string& filename);
 
+      // Save to file in the given format
+      void save(const std::string& filename, ImageFormat format);
+
+      // Save to file with the built-in PNG encoder (see PngOptions)
+      void save(const std::string& filename, const PngOptions& options);
+
+      // Save only the given region of the canvas to file
+      void save(const std::string& filename, const Rect& region);
+
+      // Save to file on a background thread, so the next frame can be drawn
+      // while this one is encoded; the canvas is copied before returning
+      // and the future reports whether the file was written. Blocks if the
+      // save queue is full (see setSaveThreads)
+      // For example, the following draws and saves frames one after another
+      // for (int i = 0; i < 10; i++) {
+      //    ...
+      //    drawer.saveAsync("frame" + std::to_string(i) + ".png");
+      // }
+      // drawer.waitForSaves();
+      std::future<bool> saveAsync(const std::string& filename);
+
+      // Save to file on a background thread with the built-in PNG encoder
+      std::future<bool> saveAsync(const std::string& filename,
+          const PngOptions& options);
+
+      // Set the number of threads used by saveAsync (default 1) and the
+      // frames that may wait for them (default 1), after finishing the
+      // saves already queued
+      void setSaveThreads(int threads, int capacity = 1);
+
+      // Block until every saveAsync call has written its file (the
+      // destructor also waits for them)
+      void waitForSaves();
+
       // Draw primitives with a given type (either LINES or TRIANGLES)
       // For example, the following draws a red line followed by a green line
       // begin(LINES);
@@ -47,7 +169,10 @@ namespace agl {
       //    vertex(0, 0);
       //    vertex(0,100);
       // end();
-      void begin(PrimitiveType type);
+      // With antialias set, lines (including triangle outlines and rose
+      // curves) and circles blend their pixel coverage into the canvas
+      // instead of setting whole pixels; filled triangles stay aliased
+      void begin(PrimitiveType type, bool antialias = false);
       void end();
 
       // Specify a vertex at raster position (x,y)
@@ -59,50 +184,186 @@ namespace agl {
       void center(int x, int y, int radius, int n = 1, int d = 1,
           bool fill = false);
 
-      // Specify a color with components in range [0,255]
+      // Specify an opaque color with components in range [0,255]
       void color(unsigned char r, unsigned char g, unsigned char b);
 
+      // Specify a color with opacity a in range [0,255]; shapes drawn with
+      // a < 255 are blended over the canvas, only on the pixels they cover
+      // (alpha is interpolated between vertices like the color)
+      void color(unsigned char r, unsigned char g, unsigned char b,
+          unsigned char a);
+
       // Fill the canvas with the given background color
       void background(unsigned char r, unsigned char g, unsigned char b);
 
+      // Fill only the given region with the background color
+      void background(unsigned char r, unsigned char g, unsigned char b,
+          const Rect& region);
+
+      // Set the number of threads end() uses to rasterize
+      // n <= 1 draws every primitive serially; n > 1 sorts primitives into
+      // 64x64 screen tiles and rasterizes the tiles in parallel, which gives
+      // the same image as the serial path
+      void setThreads(int n);
+      int threads() const;
+
+      // Set how line colors are interpolated (LINE_FIXED_POINT by default)
+      void setLineShading(LineShading shading);
+
+      // Set how unfilled circles are drawn (CIRCLE_MIDPOINT by default)
+      void setCircleOutline(CircleOutline outline);
+
+      // Set the largest distance, in pixels, a rose curve segment may stray
+      // from the true curve. A positive tolerance picks the number of
+      // segments from the amplitude and drops points that round to the
+      // same pixel; 0 (the default) always uses 361 * d segments
+      void setCurveTolerance(float pixels);
+
+      // Record the shapes of every begin()...end() into list, instead of
+      // drawing them, until endRecord() is called
+      void beginRecord(DisplayList& list);
+      void endRecord();
+
+      // Draw every shape in a recorded display list
+      void draw(const DisplayList& list);
+
+      // Draw a recorded display list, only touching pixels inside region
+      // (e.g. to redraw a dirty region after clearing it with background)
+      void draw(const DisplayList& list, const Rect& region);
+
+      // Return the regions changed by drawing since the last clearDirty()
+      // Overlapping or touching regions are merged, and once there are more
+      // than 32 they collapse into one bounding rect
+      const std::vector<Rect>& dirtyRects() const;
+
+      // Return one rect bounding every dirty region; xmin > xmax if empty
+      Rect dirtyBounds() const;
+
+      // Forget the dirty regions, e.g. after the frame has been saved
+      void clearDirty();
+
+      // Return the number of line segments emitted by end() so far
+      long segmentCount() const;
+
+      // Return the image being drawn on
+      const Image& image() const;
+
     private:
       Image _canvas;
       Pixel _color;  // current color
+      unsigned char _alpha;  // current opacity
       PrimitiveType _primitive;  // current primitive being drawn
+      bool _antialias;  // whether the current primitive is antialiased
       std::vector<Vertex> _vertices;  // list of vertices to draw
+      int _threads;  // number of threads used by end()
+      LineShading _lineShading;  // how colors are interpolated along lines
+      CircleOutline _circleOutline;  // how unfilled circles are drawn
+      float _curveTolerance;  // max rose segment error in pixels, 0 = fixed
+      long _segments;  // line segments emitted so far
+      std::vector<Shape>* _collect;  // if set, emitted shapes are stored here
+      std::vector<Shape> _shapes;  // shapes buffered for tiled rasterization
+      DisplayList* _record;  // if set, emitted shapes are recorded here
+      std::vector<Rect> _dirty;  // regions changed since clearDirty()
+      std::unique_ptr<SaveQueue> _saves;  // created by the first saveAsync
+
+      // return the queue used by saveAsync, creating it if needed
+      SaveQueue& saves();
+
+      // rasterize the shape now, or store it if shapes are being recorded
+      // or collected
+      void emit(Shape shape);
+      // rasterize a single shape, only touching pixels inside clip
+      void drawShape(const Shape& shape, const Rect& clip);
+      // return the pixel region a shape can touch, clipped to the canvas
+      Rect bounds(const Shape& shape) const;
+      // sort shapes into screen tiles and rasterize tiles on _threads
+      // threads, only touching pixels inside region
+      void drawTiled(const std::vector<Shape>& shapes, const Rect& region);
+      // return a rect covering the whole canvas
+      Rect fullRect() const;
+      // add a changed region to the dirty list
+      void markDirty(const Rect& r);
 
       // treat each pair of unique vertices in a given list of points
-      // as endpoints of a line
-      void drawLines(std::vector<Vertex>& points);
-      // helper function to draw low line in Bresenham's
-      void drawLineLow(Vertex& a, Vertex& b);
-      // helper function to draw high line in Bresenham's
-      void drawLineHigh(Vertex& a, Vertex& b);
+      // as endpoints of a line; if joined, each line after the first
+      // starts where the previous one ended, and if closed, the last line
+      // also ends where the first one started
+      void drawLines(std::vector<Vertex>& points, bool joined = false,
+          bool closed = false);
+      // draw a line between a and b with Bresenham's; if joined, the
+      // previous line of the curve already covered the pixel holding a,
+      // and if closing, the first line covered the pixel holding b
+      void drawLine(const Vertex& a, const Vertex& b, bool joined,
+          bool closing, const Rect& clip);
+      // helper function to draw a line with colors stepped in fixed point,
+      // writing horizontal and vertical lines as direct spans. The steps at
+      // major coordinates skip0 and skip1 (INT_MIN for none) are left out
+      void drawLineFixed(const Vertex& a, const Vertex& b, int skip0,
+          int skip1, const Rect& clip);
+      // helper function to draw low line in Bresenham's, leaving out the
+      // pixels in columns skip0 and skip1
+      void drawLineLow(Vertex& a, Vertex& b, int skip0, int skip1,
+          const Rect& clip);
+      // helper function to draw high line in Bresenham's, leaving out the
+      // pixels in rows skip0 and skip1
+      void drawLineHigh(Vertex& a, Vertex& b, int skip0, int skip1,
+          const Rect& clip);
+      // draw an antialiased line: step along the major axis and split each
+      // step's coverage between the two pixels straddling the line (Wu)
+      void drawLineSmooth(const Vertex& a, const Vertex& b, bool joined,
+          bool closing, const Rect& clip);
 
       // treat each triplet of unique vertices as vertices of a triangle
       void drawTriangles();
       // helper function to draw filled triangle with gouraud shading
+      // steps integer edge functions across 8x8 blocks, skipping blocks
+      // outside the triangle and testing only blocks on its edges
       void drawTriangleFill(const Vertex& p0, const Vertex& p1,
-          const Vertex& p2);
+          const Vertex& p2, const Rect& clip);
+      // helper function to draw filled triangle by evaluating the implicit
+      // line functions at every pixel of the bounding box (big canvases)
+      void drawTriangleFillImplicit(const Vertex& p0, const Vertex& p1,
+          const Vertex& p2, const Rect& box);
       // helper function to draw outlined triangle (i.e. lines)
       void drawTriangleNoFill(const Vertex& p0, const Vertex& p1,
           const Vertex& p2);
 
       // draw circles by center and radius
       void drawCircles();
-      // draw filled circle according to pixel distance from radius
-      void drawCircleFill(const Vertex& center);
+      // draw filled circle according to pixel distance from radius,
+      // one span per row
+      void drawCircleFill(const Vertex& center, const Rect& clip);
+      // draw circle circumference with the midpoint circle algorithm
+      void drawCircleOutline(const Vertex& center, const Rect& clip);
+      // draw an antialiased filled circle: full spans inside radius r and
+      // coverage falling to 0 between distance r and r + 1
+      void drawCircleFillSmooth(const Vertex& center, const Rect& clip);
+      // draw an antialiased 1 pixel wide ring, covering each pixel by
+      // 1 - |distance - r|
+      void drawCircleOutlineSmooth(const Vertex& center, const Rect& clip);
       // draw circle circumference using polyline approximation
       void drawCircleNoFill(const Vertex& center);
 
       // draw rose curves using angular frequency k = n / d and amplitude a
       void drawRoses();
+      // draw one rose curve with as few segments as _curveTolerance allows
+      void drawRoseAdaptive(const Vertex& center);
+
+      // helper function to get the clamped curve point at distance r from
+      // center, at the angle theta given in whole degrees [0, 360)
+      Vertex curvePoint(const Vertex& center, double r, int degrees);
 
       // draw Maurer rose curves using n and d and amplitude a
       void drawMaurers();
 
-      // helper function to get linear interpolated color between c1 and c2
-      Pixel interpolLinear(const Vertex& p1, const Vertex& p2, int x, int y);
+      // write color c with opacity alpha to the pixel at row y, column x,
+      // blending it over the pixel unless alpha is 255
+      void plot(int y, int x, const Pixel& c, int alpha);
+
+      // helper function to get linear interpolated color between c1 and c2,
+      // and the interpolated alpha if alpha is not NULL
+      Pixel interpolLinear(const Vertex& p1, const Vertex& p2, int x, int y,
+          int* alpha = NULL);
 
       // helper function to get gouraud-shaded color in triangle between
       // points p0, p1, and p2 at barycentric coordinate (alpha, beta, gamma)
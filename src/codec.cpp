@@ -0,0 +1,1237 @@
+/* codec.cpp
+ * Implementation of the image file formats: a PNG encoder that filters and
+ * deflates bands of rows in parallel and joins them into one zlib stream,
+ * raw and PPM rows written straight from memory, and a QOI codec
+ * @author JL
+ * @version October 16, 2026
+ *
+ * Formats: PNG (RFC 2083), zlib (RFC 1950), deflate (RFC 1951),
+ * QOI (https://qoiformat.org/qoi-specification.pdf)
+ */
+
+#include "codec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace agl {
+
+//------------------------------------------------------------//
+// checksums
+//------------------------------------------------------------//
+
+// CRC-32 tables for slicing 8 bytes at a time
+struct CrcTable {
+  uint32_t t[8][256];
+  CrcTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+      }
+    }
+  }
+};
+
+static const CrcTable& crcTable() {
+  static const CrcTable table;
+  return table;
+}
+
+// continue a CRC-32 (started at 0xFFFFFFFF, finished by inverting)
+static uint32_t crcUpdate(uint32_t crc, const unsigned char* p, size_t n) {
+  const CrcTable& c = crcTable();
+  for (; n >= 8; n -= 8, p += 8) {
+    uint32_t lo = (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24))
+        ^ crc;
+    uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t) p[7] << 24);
+    crc = c.t[7][lo & 0xFF] ^ c.t[6][(lo >> 8) & 0xFF] ^
+        c.t[5][(lo >> 16) & 0xFF] ^ c.t[4][lo >> 24] ^ c.t[3][hi & 0xFF] ^
+        c.t[2][(hi >> 8) & 0xFF] ^ c.t[1][(hi >> 16) & 0xFF] ^ c.t[0][hi >> 24];
+  }
+  for (; n > 0; n--, p++) {
+    crc = c.t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static const uint32_t ADLER_BASE = 65521;
+
+static uint32_t adlerUpdate(uint32_t adler, const unsigned char* p,
+    size_t n) {
+  uint32_t a = adler & 0xFFFF;
+  uint32_t b = adler >> 16;
+  while (n > 0) {
+    // 5552 bytes is the most that can be summed before b overflows
+    size_t chunk = min(n, (size_t) 5552);
+    n -= chunk;
+    for (size_t i = 0; i < chunk; i++) {
+      a += p[i];
+      b += a;
+    }
+    p += chunk;
+    a %= ADLER_BASE;
+    b %= ADLER_BASE;
+  }
+  return a | (b << 16);
+}
+
+// Adler-32 of two pieces of data joined, from the Adler-32 of each and the
+// length of the second (as in zlib's adler32_combine)
+static uint32_t adlerCombine(uint32_t first, uint32_t second, size_t len) {
+  uint32_t rem = len % ADLER_BASE;
+  uint32_t a = first & 0xFFFF;
+  uint32_t b = (uint32_t) (((uint64_t) rem * a) % ADLER_BASE);
+  a += (second & 0xFFFF) + ADLER_BASE - 1;
+  b += (first >> 16) + (second >> 16) + ADLER_BASE - rem;
+  if (a >= ADLER_BASE) {
+    a -= ADLER_BASE;
+  }
+  if (a >= ADLER_BASE) {
+    a -= ADLER_BASE;
+  }
+  if (b >= (ADLER_BASE << 1)) {
+    b -= (ADLER_BASE << 1);
+  }
+  if (b >= ADLER_BASE) {
+    b -= ADLER_BASE;
+  }
+  return a | (b << 16);
+}
+
+//------------------------------------------------------------//
+// deflate
+//------------------------------------------------------------//
+
+// writes bits least significant first, as deflate packs them
+class BitWriter {
+ public:
+  explicit BitWriter(vector<unsigned char>& out) : _out(out) {  }
+
+  void put(uint32_t bits, int count) {
+    _bits |= (uint64_t) bits << _count;
+    _count += count;
+    while (_count >= 8) {
+      _out.push_back(_bits & 0xFF);
+      _bits >>= 8;
+      _count -= 8;
+    }
+  }
+
+  // pad with zeros to the next byte boundary
+  void align() {
+    if (_count > 0) {
+      _out.push_back(_bits & 0xFF);
+    }
+    _bits = 0;
+    _count = 0;
+  }
+
+  vector<unsigned char>& bytes() {
+    return _out;
+  }
+
+ private:
+  vector<unsigned char>& _out;
+  uint64_t _bits = 0;
+  int _count = 0;
+};
+
+static const int WINDOW = 32768;
+static const int MIN_MATCH = 3;
+static const int MAX_MATCH = 258;
+static const int HASH_BITS = 15;
+static const int BLOCK_SYMBOLS = 16384;  // symbols per Huffman block
+
+static const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17,
+    19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2,
+    2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49,
+    65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+static const int DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5,
+    6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// order the code length code lengths are sent in
+static const int CLEN_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4,
+    12, 3, 13, 2, 14, 1, 15};
+
+// match search effort per level, like zlib's configuration table
+struct LevelConfig {
+  int good;  // shorten the chain once the previous match is this long
+  int lazy;  // greedy levels: longest match whose positions are all hashed
+             // lazy levels: don't look for a better match past this length
+  int nice;  // stop searching at a match this long
+  int chain;  // most candidates tried per position
+  bool lazyMatch;  // whether to check the next position for a better match
+};
+
+static const LevelConfig LEVELS[10] = {
+    {0, 0, 0, 0, false}, {4, 4, 8, 4, false}, {4, 5, 16, 8, false},
+    {4, 6, 32, 32, false}, {4, 4, 16, 16, true}, {8, 16, 32, 32, true},
+    {8, 16, 128, 128, true}, {8, 32, 128, 256, true},
+    {32, 128, 258, 1024, true}, {32, 258, 258, 4096, true}};
+
+// tables mapping lengths and distances to their deflate codes
+struct CodeTables {
+  uint8_t lengthCode[MAX_MATCH + 1];  // 0 to 28
+  uint8_t distCode[512];  // see distSymbol
+  CodeTables() {
+    for (int c = 0; c < 29; c++) {
+      int end = (c == 28) ? MAX_MATCH + 1 : LENGTH_BASE[c + 1];
+      for (int len = LENGTH_BASE[c]; len < end; len++) {
+        lengthCode[len] = c;
+      }
+    }
+    for (int c = 0; c < 30; c++) {
+      int end = (c == 29) ? WINDOW + 1 : DIST_BASE[c + 1];
+      for (int d = DIST_BASE[c]; d < end; d++) {
+        if (d <= 256) {
+          distCode[d - 1] = c;
+        } else {
+          distCode[256 + ((d - 1) >> 7)] = c;
+        }
+      }
+    }
+  }
+};
+
+static const CodeTables& codeTables() {
+  static const CodeTables tables;
+  return tables;
+}
+
+static int distSymbol(const CodeTables& t, int dist) {
+  return (dist <= 256) ? t.distCode[dist - 1] : t.distCode[256 +
+      ((dist - 1) >> 7)];
+}
+
+// a literal (dist = 0) or a match of length litlen at distance dist
+struct Symbol {
+  uint16_t litlen;
+  uint16_t dist;
+};
+
+// fill lengths[0, n) with Huffman code lengths of at most limit bits for
+// the given frequencies (0 for unused symbols); any used symbol set gets a
+// complete code, pairing a lone symbol with a second one
+static void buildLengths(const uint32_t* freq, int n, int limit,
+    uint8_t* lengths) {
+  memset(lengths, 0, n);
+  vector<int> used;
+  for (int i = 0; i < n; i++) {
+    if (freq[i] > 0) {
+      used.push_back(i);
+    }
+  }
+  if (used.size() < 2) {
+    int only = used.empty() ? 0 : used[0];
+    lengths[only] = 1;
+    lengths[only == 0 ? 1 : 0] = 1;
+    return;
+  }
+  // Huffman tree by the two-queue method over leaves sorted by frequency
+  sort(used.begin(), used.end(), [&](int a, int b) {
+    return freq[a] < freq[b] || (freq[a] == freq[b] && a < b);
+  });
+  int m = used.size();
+  vector<uint64_t> weight(2 * m - 1);
+  vector<int> parent(2 * m - 1, -1);
+  for (int i = 0; i < m; i++) {
+    weight[i] = freq[used[i]];
+  }
+  int leaf = 0;
+  int node = m;  // next internal node to take
+  for (int next = m; next < 2 * m - 1; next++) {
+    int pick[2];
+    for (int k = 0; k < 2; k++) {
+      if (leaf < m && (node >= next || weight[leaf] <= weight[node])) {
+        pick[k] = leaf++;
+      } else {
+        pick[k] = node++;
+      }
+    }
+    weight[next] = weight[pick[0]] + weight[pick[1]];
+    parent[pick[0]] = next;
+    parent[pick[1]] = next;
+  }
+  // depths from the root down
+  vector<int> depth(2 * m - 1, 0);
+  int maxDepth = 0;
+  for (int i = 2 * m - 3; i >= 0; i--) {
+    depth[i] = depth[parent[i]] + 1;
+    maxDepth = max(maxDepth, i < m ? depth[i] : 0);
+  }
+  vector<int> count(max(maxDepth, limit) + 1, 0);
+  for (int i = 0; i < m; i++) {
+    count[depth[i]]++;
+  }
+  // move the leaves deeper than limit up, keeping the code complete (the
+  // same adjustment as JPEG's Annex K)
+  for (int i = maxDepth; i > limit; i--) {
+    while (count[i] > 0) {
+      int j = i - 2;
+      while (count[j] == 0) {
+        j--;
+      }
+      count[i] -= 2;
+      count[i - 1]++;
+      count[j + 1] += 2;
+      count[j]--;
+    }
+  }
+  // the most frequent symbols get the shortest codes
+  int bits = 1;
+  for (int i = m - 1; i >= 0; i--) {
+    while (count[bits] == 0) {
+      bits++;
+    }
+    lengths[used[i]] = bits;
+    count[bits]--;
+  }
+}
+
+// canonical codes for the lengths, bit-reversed for writing LSB first
+static void buildCodes(const uint8_t* lengths, int n, uint16_t* codes) {
+  int count[16] = {0};
+  for (int i = 0; i < n; i++) {
+    count[lengths[i]]++;
+  }
+  count[0] = 0;
+  int next[16];
+  int code = 0;
+  for (int bits = 1; bits < 16; bits++) {
+    code = (code + count[bits - 1]) << 1;
+    next[bits] = code;
+  }
+  for (int i = 0; i < n; i++) {
+    int len = lengths[i];
+    if (len == 0) {
+      codes[i] = 0;
+      continue;
+    }
+    int c = next[len]++;
+    int reversed = 0;
+    for (int k = 0; k < len; k++) {
+      reversed = (reversed << 1) | ((c >> k) & 1);
+    }
+    codes[i] = reversed;
+  }
+}
+
+// one band's worth of deflate: LZ77 matching into symbols, then Huffman
+// coded blocks
+class Deflater {
+ public:
+  Deflater(int level, BitWriter& out)
+      : _level(min(max(level, 0), 9)), _out(out) {  }
+
+  // compress data[0, n) as blocks ending with final (or, if not final, a
+  // sync flush that leaves the stream on a byte boundary)
+  void compress(const unsigned char* data, long n, bool final);
+
+ private:
+  int _level;
+  BitWriter& _out;
+  const unsigned char* _data = NULL;
+  vector<Symbol> _symbols;
+  long _blockStart = 0;  // first byte covered by _symbols
+
+  void literal(long pos);
+  void match(int length, int dist);
+  void flushBlock(long end, bool final);
+  void writeStored(const unsigned char* p, long n, bool final);
+  void writeSymbols(const uint16_t* litCodes, const uint8_t* litLengths,
+      const uint16_t* distCodes, const uint8_t* distLengths);
+};
+
+void Deflater::literal(long pos) {
+  _symbols.push_back(Symbol{_data[pos], 0});
+}
+
+void Deflater::match(int length, int dist) {
+  _symbols.push_back(Symbol{(uint16_t) length, (uint16_t) dist});
+}
+
+void Deflater::writeStored(const unsigned char* p, long n, bool final) {
+  do {
+    long chunk = min(n, 65535L);
+    n -= chunk;
+    _out.put((final && n == 0) ? 1 : 0, 1);
+    _out.put(0, 2);
+    _out.align();
+    vector<unsigned char>& bytes = _out.bytes();
+    unsigned char header[4] = {(unsigned char) (chunk & 0xFF),
+        (unsigned char) (chunk >> 8), (unsigned char) (~chunk & 0xFF),
+        (unsigned char) ((~chunk >> 8) & 0xFF)};
+    bytes.insert(bytes.end(), header, header + 4);
+    bytes.insert(bytes.end(), p, p + chunk);
+    p += chunk;
+  } while (n > 0);
+}
+
+void Deflater::writeSymbols(const uint16_t* litCodes,
+    const uint8_t* litLengths, const uint16_t* distCodes,
+    const uint8_t* distLengths) {
+  const CodeTables& t = codeTables();
+  for (const Symbol& s : _symbols) {
+    if (s.dist == 0) {
+      _out.put(litCodes[s.litlen], litLengths[s.litlen]);
+      continue;
+    }
+    int lc = t.lengthCode[s.litlen];
+    _out.put(litCodes[257 + lc], litLengths[257 + lc]);
+    _out.put(s.litlen - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+    int dc = distSymbol(t, s.dist);
+    _out.put(distCodes[dc], distLengths[dc]);
+    _out.put(s.dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+  }
+  _out.put(litCodes[256], litLengths[256]);  // end of block
+}
+
+void Deflater::flushBlock(long end, bool final) {
+  const CodeTables& t = codeTables();
+  uint32_t litFreq[286] = {0};
+  uint32_t distFreq[30] = {0};
+  long extraBits = 0;
+  for (const Symbol& s : _symbols) {
+    if (s.dist == 0) {
+      litFreq[s.litlen]++;
+    } else {
+      int lc = t.lengthCode[s.litlen];
+      int dc = distSymbol(t, s.dist);
+      litFreq[257 + lc]++;
+      distFreq[dc]++;
+      extraBits += LENGTH_EXTRA[lc] + DIST_EXTRA[dc];
+    }
+  }
+  litFreq[256] = 1;
+  // dynamic codes
+  uint8_t litLengths[286];
+  uint8_t distLengths[30];
+  buildLengths(litFreq, 286, 15, litLengths);
+  buildLengths(distFreq, 30, 15, distLengths);
+  int hlit = 286;
+  while (hlit > 257 && litLengths[hlit - 1] == 0) {
+    hlit--;
+  }
+  int hdist = 30;
+  while (hdist > 1 && distLengths[hdist - 1] == 0) {
+    hdist--;
+  }
+  // run-length code the lengths with codes 16 (repeat previous), 17 and
+  // 18 (runs of zeros); each entry is code | extra value << 8
+  uint8_t all[286 + 30];
+  memcpy(all, litLengths, hlit);
+  memcpy(all + hlit, distLengths, hdist);
+  int total = hlit + hdist;
+  vector<uint16_t> runs;
+  uint32_t clenFreq[19] = {0};
+  for (int i = 0; i < total;) {
+    int len = all[i];
+    int run = 1;
+    while (i + run < total && all[i + run] == len) {
+      run++;
+    }
+    i += run;
+    if (len == 0) {
+      while (run >= 11) {
+        int r = min(run, 138);
+        runs.push_back(18 | ((r - 11) << 8));
+        run -= r;
+      }
+      if (run >= 3) {
+        runs.push_back(17 | ((run - 3) << 8));
+        run = 0;
+      }
+    } else {
+      runs.push_back(len);
+      run--;
+      while (run >= 3) {
+        int r = min(run, 6);
+        runs.push_back(16 | ((r - 3) << 8));
+        run -= r;
+      }
+    }
+    for (; run > 0; run--) {
+      runs.push_back(len);
+    }
+  }
+  for (uint16_t r : runs) {
+    clenFreq[r & 0xFF]++;
+  }
+  uint8_t clenLengths[19];
+  buildLengths(clenFreq, 19, 7, clenLengths);
+  int hclen = 19;
+  while (hclen > 4 && clenLengths[CLEN_ORDER[hclen - 1]] == 0) {
+    hclen--;
+  }
+  // compare the sizes of the three block types, in bits
+  long dynamicBits = 3 + 5 + 5 + 4 + 3 * hclen + extraBits;
+  for (uint16_t r : runs) {
+    int c = r & 0xFF;
+    dynamicBits += clenLengths[c] + (c == 16 ? 2 : c == 17 ? 3 : c == 18 ? 7 :
+        0);
+  }
+  long fixedBits = 3 + extraBits;
+  for (int i = 0; i < 286; i++) {
+    dynamicBits += (long) litFreq[i] * litLengths[i];
+    fixedBits += (long) litFreq[i] * (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 :
+        8);
+  }
+  for (int i = 0; i < 30; i++) {
+    dynamicBits += (long) distFreq[i] * distLengths[i];
+    fixedBits += (long) distFreq[i] * 5;
+  }
+  long storedBits = (end - _blockStart + 5 * ((end - _blockStart) / 65535 +
+      1)) * 8 + 7;
+  if (storedBits <= min(dynamicBits, fixedBits)) {
+    writeStored(_data + _blockStart, end - _blockStart, final);
+  } else if (fixedBits <= dynamicBits) {
+    uint8_t fixedLit[288];
+    uint8_t fixedDist[30];
+    uint16_t litCodes[288];
+    uint16_t distCodes[30];
+    for (int i = 0; i < 288; i++) {
+      fixedLit[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    memset(fixedDist, 5, sizeof(fixedDist));
+    buildCodes(fixedLit, 288, litCodes);
+    buildCodes(fixedDist, 30, distCodes);
+    _out.put(final ? 1 : 0, 1);
+    _out.put(1, 2);
+    writeSymbols(litCodes, fixedLit, distCodes, fixedDist);
+  } else {
+    uint16_t litCodes[286];
+    uint16_t distCodes[30];
+    uint16_t clenCodes[19];
+    buildCodes(litLengths, 286, litCodes);
+    buildCodes(distLengths, 30, distCodes);
+    buildCodes(clenLengths, 19, clenCodes);
+    _out.put(final ? 1 : 0, 1);
+    _out.put(2, 2);
+    _out.put(hlit - 257, 5);
+    _out.put(hdist - 1, 5);
+    _out.put(hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) {
+      _out.put(clenLengths[CLEN_ORDER[i]], 3);
+    }
+    for (uint16_t r : runs) {
+      int c = r & 0xFF;
+      _out.put(clenCodes[c], clenLengths[c]);
+      if (c >= 16) {
+        _out.put(r >> 8, c == 16 ? 2 : c == 17 ? 3 : 7);
+      }
+    }
+    writeSymbols(litCodes, litLengths, distCodes, distLengths);
+  }
+  _symbols.clear();
+  _blockStart = end;
+}
+
+// hash of the 3 bytes at p
+static inline uint32_t hash3(const unsigned char* p) {
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// length of the common prefix of a and b, at most limit
+static inline int matchLength(const unsigned char* a, const unsigned char* b,
+    int limit) {
+  int len = 0;
+  while (len + 8 <= limit) {
+    uint64_t x;
+    uint64_t y;
+    memcpy(&x, a + len, 8);
+    memcpy(&y, b + len, 8);
+    if (x != y) {
+      break;  // the bytes below find where
+    }
+    len += 8;
+  }
+  while (len < limit && a[len] == b[len]) {
+    len++;
+  }
+  return len;
+}
+
+void Deflater::compress(const unsigned char* data, long n, bool final) {
+  _data = data;
+  _blockStart = 0;
+  _symbols.clear();
+  if (_level == 0 || n == 0) {
+    writeStored(data, n, final);
+  } else {
+    const LevelConfig& config = LEVELS[_level];
+    _symbols.reserve(BLOCK_SYMBOLS);
+    vector<int> head(1 << HASH_BITS, -1);
+    vector<int> prev(WINDOW, -1);
+    auto insert = [&](long pos) {
+      uint32_t h = hash3(data + pos);
+      prev[pos & (WINDOW - 1)] = head[h];
+      head[h] = pos;
+    };
+    // longest match for pos among earlier positions with the same hash,
+    // at least better than length (0 if none)
+    auto find = [&](long pos, int chain, int better, int& dist) {
+      int limit = (int) min((long) MAX_MATCH, n - pos);
+      if (better >= limit) {
+        return 0;
+      }
+      int best = better;
+      int candidate = head[hash3(data + pos)];
+      while (candidate >= 0 && pos - candidate <= WINDOW && chain-- > 0) {
+        // check the byte that would extend the best match first
+        if (data[candidate + best] == data[pos + best] || best == 0) {
+          int len = matchLength(data + candidate, data + pos, limit);
+          if (len > best) {
+            best = len;
+            dist = pos - candidate;
+            if (len >= config.nice || len == limit) {
+              break;
+            }
+          }
+        }
+        int next = prev[candidate & (WINDOW - 1)];
+        if (next >= candidate) {
+          break;  // the slot was reused by a newer position
+        }
+        candidate = next;
+      }
+      // a short match far away costs more than its literals
+      if (best == MIN_MATCH && dist > 4096) {
+        best = 0;
+      }
+      return (best > better) ? best : 0;
+    };
+    long pos = 0;
+    if (!config.lazyMatch) {
+      while (pos < n) {
+        int dist = 0;
+        int len = (pos + MIN_MATCH <= n) ? find(pos, config.chain,
+            MIN_MATCH - 1, dist) : 0;
+        if (pos + MIN_MATCH <= n) {
+          insert(pos);
+        }
+        if (len >= MIN_MATCH) {
+          match(len, dist);
+          if (len <= config.lazy) {
+            for (long k = pos + 1; k < pos + len && k + MIN_MATCH <= n; k++) {
+              insert(k);
+            }
+          }
+          pos += len;
+        } else {
+          literal(pos);
+          pos++;
+        }
+        if ((int) _symbols.size() >= BLOCK_SYMBOLS) {
+          flushBlock(pos, false);
+        }
+      }
+    } else {
+      // lazy matching: keep the match found at pos - 1 unless pos starts a
+      // longer one
+      int prevLen = 0;
+      int prevDist = 0;
+      bool pending = false;
+      while (pos < n) {
+        int dist = 0;
+        int len = 0;
+        if (pos + MIN_MATCH <= n) {
+          if (prevLen < config.lazy) {
+            int chain = (prevLen >= config.good) ? config.chain >> 2 :
+                config.chain;
+            len = find(pos, chain, max(prevLen, MIN_MATCH - 1), dist);
+          }
+          insert(pos);
+        }
+        if (pending && prevLen >= MIN_MATCH && len <= prevLen) {
+          match(prevLen, prevDist);
+          for (long k = pos + 1; k < pos - 1 + prevLen && k + MIN_MATCH <= n;
+              k++) {
+            insert(k);
+          }
+          pos += prevLen - 1;
+          pending = false;
+          prevLen = 0;
+        } else {
+          if (pending) {
+            literal(pos - 1);
+          }
+          pending = true;
+          prevLen = len;
+          prevDist = dist;
+          pos++;
+        }
+        if ((int) _symbols.size() >= BLOCK_SYMBOLS) {
+          flushBlock(pos - (pending ? 1 : 0), false);
+        }
+      }
+      if (pending) {
+        literal(n - 1);
+      }
+    }
+    flushBlock(n, final);
+  }
+  if (!final) {
+    // sync flush: an empty stored block ends the band on a byte boundary
+    _out.put(0, 3);
+    _out.align();
+    unsigned char empty[4] = {0, 0, 0xFF, 0xFF};
+    _out.bytes().insert(_out.bytes().end(), empty, empty + 4);
+  } else {
+    _out.align();
+  }
+}
+
+//------------------------------------------------------------//
+// PNG
+//------------------------------------------------------------//
+
+PngOptions PngOptions::fast() {
+  PngOptions options;
+  options.level = 1;
+  options.filter = PNG_FILTER_UP;
+  options.threads = max((int) thread::hardware_concurrency(), 1);
+  return options;
+}
+
+static int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return (pb <= pc) ? b : c;
+}
+
+// write filter type then the filtered bytes of row (n bytes, 3 per pixel)
+// to out, given the unfiltered row above (NULL for the first row)
+static void filterRow(int type, const unsigned char* row,
+    const unsigned char* above, int n, unsigned char* out) {
+  out[0] = type;
+  out++;
+  for (int i = 0; i < n; i++) {
+    int a = (i >= 3) ? row[i - 3] : 0;
+    int b = above ? above[i] : 0;
+    int c = (above && i >= 3) ? above[i - 3] : 0;
+    int pred = 0;
+    switch (type) {
+      case PNG_FILTER_SUB:
+        pred = a;
+        break;
+      case PNG_FILTER_UP:
+        pred = b;
+        break;
+      case PNG_FILTER_AVERAGE:
+        pred = (a + b) >> 1;
+        break;
+      case PNG_FILTER_PAETH:
+        pred = paeth(a, b, c);
+        break;
+      default:
+        break;
+    }
+    out[i] = row[i] - pred;
+  }
+}
+
+// sum of the filtered bytes read as signed values, the adaptive heuristic
+static int64_t filterCost(const unsigned char* filtered, int n) {
+  int64_t sum = 0;
+  for (int i = 1; i <= n; i++) {
+    sum += abs((signed char) filtered[i]);
+  }
+  return sum;
+}
+
+// filtered rows and compressed bytes of one band
+struct PngBand {
+  vector<unsigned char> data;  // IDAT chunk data
+  uint32_t adler = 1;  // Adler-32 of the filtered rows
+  int64_t length = 0;  // bytes of filtered rows
+  uint32_t crc = 0;  // running CRC-32 of "IDAT" and data
+};
+
+static void encodeBand(const unsigned char* pixels, int width, int64_t stride,
+    int y0, int y1, bool first, bool last, const PngOptions& options,
+    PngBand& band) {
+  int n = width * 3;
+  vector<unsigned char> filtered((int64_t) (y1 - y0) * (n + 1));
+  vector<unsigned char> trial(options.filter == PNG_FILTER_ADAPTIVE ?
+      n + 1 : 0);
+  for (int y = y0; y < y1; y++) {
+    const unsigned char* row = pixels + y * stride;
+    const unsigned char* above = (y > 0) ? row - stride : NULL;
+    unsigned char* out = filtered.data() + (int64_t) (y - y0) * (n + 1);
+    if (options.filter != PNG_FILTER_ADAPTIVE) {
+      filterRow(options.filter, row, above, n, out);
+      continue;
+    }
+    int64_t best = -1;
+    for (int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+      filterRow(type, row, above, n, trial.data());
+      int64_t cost = filterCost(trial.data(), n);
+      if (best < 0 || cost < best) {
+        best = cost;
+        memcpy(out, trial.data(), n + 1);
+      }
+    }
+  }
+  band.length = filtered.size();
+  band.adler = adlerUpdate(1, filtered.data(), filtered.size());
+  band.data.clear();
+  band.data.reserve(filtered.size() / 2);
+  if (first) {
+    // zlib header: deflate with a 32 KB window, level hint, no dictionary
+    int hint = (options.level <= 1) ? 0 : (options.level <= 5) ? 1 :
+        (options.level == 6) ? 2 : 3;
+    int cmf = 0x78;
+    int flg = hint << 6;
+    flg += 31 - ((cmf * 256 + flg) % 31);
+    band.data.push_back(cmf);
+    band.data.push_back(flg);
+  }
+  BitWriter bits(band.data);
+  Deflater deflater(options.level, bits);
+  deflater.compress(filtered.data(), filtered.size(), last);
+  band.crc = crcUpdate(0xFFFFFFFF, (const unsigned char*) "IDAT", 4);
+  band.crc = crcUpdate(band.crc, band.data.data(), band.data.size());
+}
+
+static void putBigEndian(vector<unsigned char>& out, uint32_t v) {
+  out.push_back(v >> 24);
+  out.push_back((v >> 16) & 0xFF);
+  out.push_back((v >> 8) & 0xFF);
+  out.push_back(v & 0xFF);
+}
+
+// append a whole chunk (length, type, data, CRC) to out
+static void putChunk(vector<unsigned char>& out, const char* type,
+    const unsigned char* data, uint32_t length) {
+  putBigEndian(out, length);
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + length);
+  uint32_t crc = crcUpdate(0xFFFFFFFF, (const unsigned char*) type, 4);
+  putBigEndian(out, ~crcUpdate(crc, data, length));
+}
+
+vector<unsigned char> encodePng(const unsigned char* pixels, int width,
+    int height, int64_t stride, const PngOptions& options) {
+  vector<unsigned char> png;
+  if (width <= 0 || height <= 0) {
+    cout << "Error: cannot encode an empty image" << endl;
+    return png;
+  }
+  int rows = options.bandRows;
+  if (rows <= 0) {
+    // about 1 MB of pixels per band keeps the cost of restarting the
+    // match window small while leaving bands for every thread
+    rows = max((int) ((1 << 20) / ((int64_t) width * 3)), 1);
+  }
+  int numBands = (height + rows - 1) / rows;
+  vector<PngBand> bands(numBands);
+  // workers take the next unclaimed band until none are left
+  atomic<int> nextBand(0);
+  auto worker = [&]() {
+    for (int t = nextBand++; t < numBands; t = nextBand++) {
+      int y0 = t * rows;
+      int y1 = min(y0 + rows, height);
+      encodeBand(pixels, width, stride, y0, y1, t == 0, t == numBands - 1,
+          options, bands[t]);
+    }
+  };
+  int numWorkers = min(max(options.threads, 1), numBands);
+  vector<thread> pool;
+  for (int i = 1; i < numWorkers; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();  // calling thread also encodes bands
+  for (thread& t : pool) {
+    t.join();
+  }
+
+  const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  png.insert(png.end(), signature, signature + 8);
+  unsigned char header[13] = {0};
+  for (int i = 0; i < 4; i++) {
+    header[i] = (width >> (24 - 8 * i)) & 0xFF;
+    header[4 + i] = (height >> (24 - 8 * i)) & 0xFF;
+  }
+  header[8] = 8;  // bits per channel
+  header[9] = 2;  // RGB
+  putChunk(png, "IHDR", header, 13);
+  // the zlib stream ends with the Adler-32 of every band's rows
+  uint32_t adler = bands[0].adler;
+  for (int t = 1; t < numBands; t++) {
+    adler = adlerCombine(adler, bands[t].adler, bands[t].length);
+  }
+  unsigned char trailer[4] = {(unsigned char) (adler >> 24),
+      (unsigned char) ((adler >> 16) & 0xFF),
+      (unsigned char) ((adler >> 8) & 0xFF), (unsigned char) (adler & 0xFF)};
+  for (int t = 0; t < numBands; t++) {
+    PngBand& band = bands[t];
+    bool last = t == numBands - 1;
+    putBigEndian(png, band.data.size() + (last ? 4 : 0));
+    png.insert(png.end(), "IDAT", "IDAT" + 4);
+    png.insert(png.end(), band.data.begin(), band.data.end());
+    uint32_t crc = band.crc;
+    if (last) {
+      png.insert(png.end(), trailer, trailer + 4);
+      crc = crcUpdate(crc, trailer, 4);
+    }
+    putBigEndian(png, ~crc);
+  }
+  putChunk(png, "IEND", NULL, 0);
+  return png;
+}
+
+bool writePng(const string& filename, const unsigned char* pixels, int width,
+    int height, int64_t stride, const PngOptions& options) {
+  vector<unsigned char> png = encodePng(pixels, width, height, stride,
+      options);
+  if (png.empty()) {
+    return false;
+  }
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool ok = fwrite(png.data(), 1, png.size(), f) == png.size();
+  return (fclose(f) == 0) && ok;
+}
+}  // namespace agl
+
+namespace agl {
+
+//------------------------------------------------------------//
+// raw and PPM
+//------------------------------------------------------------//
+
+ImageFormat formatFromName(const string& filename) {
+  size_t dot = filename.find_last_of('.');
+  if (dot == string::npos) {
+    return FORMAT_PNG;
+  }
+  string ext = filename.substr(dot + 1);
+  for (char& c : ext) {
+    c = tolower(c);
+  }
+  if (ext == "raw" || ext == "rgb") {
+    return FORMAT_RAW;
+  } else if (ext == "ppm") {
+    return FORMAT_PPM;
+  } else if (ext == "qoi") {
+    return FORMAT_QOI;
+  }
+  return FORMAT_PNG;
+}
+
+bool writeRows(const string& filename, const string& header,
+    const unsigned char* rows, int64_t rowBytes, int count, int64_t stride) {
+#ifdef _WIN32
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  setvbuf(f, NULL, _IONBF, 0);  // write from rows, not through a buffer
+  bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+  if (stride == rowBytes) {
+    ok = ok && fwrite(rows, 1, rowBytes * count, f) == rowBytes * count;
+  } else {
+    for (int i = 0; ok && i < count; i++) {
+      ok = fwrite(rows + i * stride, 1, rowBytes, f) == rowBytes;
+    }
+  }
+  return (fclose(f) == 0) && ok;
+#else
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  // one piece for the header and one for all the rows if they are
+  // contiguous, otherwise one per row
+  vector<iovec> parts;
+  if (!header.empty()) {
+    parts.push_back(iovec{(void*) header.data(), header.size()});
+  }
+  if (stride == rowBytes) {
+    parts.push_back(iovec{(void*) rows, (size_t) rowBytes * count});
+  } else {
+    for (int i = 0; i < count; i++) {
+      parts.push_back(iovec{(void*) (rows + i * stride), (size_t) rowBytes});
+    }
+  }
+  const size_t maxParts = 1024;  // IOV_MAX on Linux and macOS
+  bool ok = true;
+  size_t next = 0;
+  while (ok && next < parts.size()) {
+    ssize_t written = writev(fd, &parts[next],
+        min(parts.size() - next, maxParts));
+    if (written < 0) {
+      ok = (errno == EINTR);  // retry if interrupted
+      continue;
+    }
+    // skip the pieces that were written and trim a partly written one
+    while (written > 0) {
+      if ((size_t) written >= parts[next].iov_len) {
+        written -= parts[next].iov_len;
+        next++;
+      } else {
+        parts[next].iov_base = (char*) parts[next].iov_base + written;
+        parts[next].iov_len -= written;
+        written = 0;
+      }
+    }
+  }
+  return (close(fd) == 0) && ok;
+#endif
+}
+
+string ppmHeader(int width, int height) {
+  return "P6\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+}
+
+bool parsePpmHeader(const unsigned char* data, int64_t n, int& width,
+    int& height, int64_t& offset) {
+  if (n < 2 || data[0] != 'P' || data[1] != '6') {
+    return false;
+  }
+  int64_t p = 2;
+  // width, height and maxval, each after whitespace and # comments
+  int64_t values[3];
+  for (int k = 0; k < 3; k++) {
+    while (p < n && (isspace(data[p]) || data[p] == '#')) {
+      if (data[p] == '#') {
+        while (p < n && data[p] != '\n') {
+          p++;
+        }
+      } else {
+        p++;
+      }
+    }
+    if (p >= n || !isdigit(data[p])) {
+      return false;
+    }
+    values[k] = 0;
+    while (p < n && isdigit(data[p]) && values[k] <= 1000000) {
+      values[k] = values[k] * 10 + (data[p] - '0');
+      p++;
+    }
+  }
+  // exactly one whitespace byte ends the header
+  if (p >= n || !isspace(data[p]) || values[0] <= 0 || values[1] <= 0 ||
+      values[0] > 1000000 || values[1] > 1000000 || values[2] != 255) {
+    return false;
+  }
+  width = values[0];
+  height = values[1];
+  offset = p + 1;
+  return true;
+}
+
+//------------------------------------------------------------//
+// QOI
+//------------------------------------------------------------//
+
+static const int QOI_HEADER = 14;
+static const int QOI_PADDING = 8;  // end marker: 7 zeros and a 1
+static const unsigned char QOI_END[QOI_PADDING] = {0, 0, 0, 0, 0, 0, 0, 1};
+static const unsigned char QOI_OP_INDEX = 0x00;
+static const unsigned char QOI_OP_DIFF = 0x40;
+static const unsigned char QOI_OP_LUMA = 0x80;
+static const unsigned char QOI_OP_RUN = 0xC0;
+static const unsigned char QOI_OP_RGB = 0xFE;
+static const unsigned char QOI_OP_RGBA = 0xFF;
+
+// a pixel as r, g, b, a bytes
+struct QoiPixel {
+  unsigned char r, g, b, a;
+  bool operator==(const QoiPixel& o) const {
+    return r == o.r && g == o.g && b == o.b && a == o.a;
+  }
+};
+
+static inline int qoiHash(const QoiPixel& p) {
+  return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+static void putBig32(unsigned char* out, uint32_t v) {
+  out[0] = v >> 24;
+  out[1] = (v >> 16) & 0xFF;
+  out[2] = (v >> 8) & 0xFF;
+  out[3] = v & 0xFF;
+}
+
+static uint32_t getBig32(const unsigned char* in) {
+  return ((uint32_t) in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+}
+
+vector<unsigned char> encodeQoi(const unsigned char* pixels, int width,
+    int height, int64_t stride) {
+  // at most 4 bytes per pixel (QOI_OP_RGB)
+  vector<unsigned char> qoi(QOI_HEADER + (size_t) width * height * 4 +
+      QOI_PADDING);
+  unsigned char* out = qoi.data();
+  memcpy(out, "qoif", 4);
+  putBig32(out + 4, width);
+  putBig32(out + 8, height);
+  out[12] = 3;  // RGB
+  out[13] = 0;  // sRGB
+  out += QOI_HEADER;
+  QoiPixel index[64];
+  memset(index, 0, sizeof(index));
+  QoiPixel prev = {0, 0, 0, 255};
+  int run = 0;
+  for (int y = 0; y < height; y++) {
+    const unsigned char* row = pixels + y * stride;
+    for (int x = 0; x < width; x++) {
+      QoiPixel px = {row[x * 3], row[x * 3 + 1], row[x * 3 + 2], 255};
+      if (px == prev) {
+        run++;
+        if (run == 62) {
+          *out++ = QOI_OP_RUN | (run - 1);
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        *out++ = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      int h = qoiHash(px);
+      if (index[h] == px) {
+        *out++ = QOI_OP_INDEX | h;
+      } else {
+        index[h] = px;
+        // channel differences wrap around like the bytes
+        int dr = (signed char) (px.r - prev.r);
+        int dg = (signed char) (px.g - prev.g);
+        int db = (signed char) (px.b - prev.b);
+        int drg = dr - dg;
+        int dbg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+            db <= 1) {
+          *out++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+        } else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 &&
+            dbg >= -8 && dbg <= 7) {
+          *out++ = QOI_OP_LUMA | (dg + 32);
+          *out++ = ((drg + 8) << 4) | (dbg + 8);
+        } else {
+          *out++ = QOI_OP_RGB;
+          *out++ = px.r;
+          *out++ = px.g;
+          *out++ = px.b;
+        }
+      }
+      prev = px;
+    }
+  }
+  if (run > 0) {
+    *out++ = QOI_OP_RUN | (run - 1);
+  }
+  memcpy(out, QOI_END, QOI_PADDING);
+  out += QOI_PADDING;
+  qoi.resize(out - qoi.data());
+  return qoi;
+}
+
+bool qoiSize(const unsigned char* data, int64_t n, int& width, int& height) {
+  if (n < QOI_HEADER + QOI_PADDING || memcmp(data, "qoif", 4) != 0) {
+    return false;
+  }
+  uint32_t w = getBig32(data + 4);
+  uint32_t h = getBig32(data + 8);
+  if (w == 0 || h == 0 || w > 1000000 || h > 1000000 ||
+      (data[12] != 3 && data[12] != 4)) {
+    return false;
+  }
+  width = w;
+  height = h;
+  return true;
+}
+
+bool decodeQoi(const unsigned char* data, int64_t n, unsigned char* pixels,
+    int64_t stride) {
+  int width;
+  int height;
+  if (!qoiSize(data, n, width, height)) {
+    return false;
+  }
+  // the padding guarantees the 4 bytes an op can read are in the data
+  int64_t end = n - QOI_PADDING;
+  int64_t p = QOI_HEADER;
+  QoiPixel index[64];
+  memset(index, 0, sizeof(index));
+  QoiPixel px = {0, 0, 0, 255};
+  int run = 0;
+  for (int y = 0; y < height; y++) {
+    unsigned char* row = pixels + y * stride;
+    for (int x = 0; x < width; x++) {
+      if (run > 0) {
+        run--;
+      } else if (p < end) {
+        int b1 = data[p++];
+        if (b1 == QOI_OP_RGB) {
+          px.r = data[p];
+          px.g = data[p + 1];
+          px.b = data[p + 2];
+          p += 3;
+        } else if (b1 == QOI_OP_RGBA) {
+          px.r = data[p];
+          px.g = data[p + 1];
+          px.b = data[p + 2];
+          px.a = data[p + 3];
+          p += 4;
+        } else if ((b1 & 0xC0) == QOI_OP_INDEX) {
+          px = index[b1];
+        } else if ((b1 & 0xC0) == QOI_OP_DIFF) {
+          px.r += ((b1 >> 4) & 0x03) - 2;
+          px.g += ((b1 >> 2) & 0x03) - 2;
+          px.b += (b1 & 0x03) - 2;
+        } else if ((b1 & 0xC0) == QOI_OP_LUMA) {
+          int b2 = data[p++];
+          int dg = (b1 & 0x3F) - 32;
+          px.r += dg - 8 + ((b2 >> 4) & 0x0F);
+          px.g += dg;
+          px.b += dg - 8 + (b2 & 0x0F);
+        } else {
+          run = b1 & 0x3F;
+        }
+        index[qoiHash(px)] = px;
+      } else {
+        return false;  // ran out of data
+      }
+      row[x * 3] = px.r;
+      row[x * 3 + 1] = px.g;
+      row[x * 3 + 2] = px.b;
+    }
+  }
+  // the last op may have read into the padding if the file was cut short
+  return p <= end && memcmp(data + end, QOI_END, QOI_PADDING) == 0;
+}
+}  // namespace agl
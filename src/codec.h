@@ -0,0 +1,108 @@
+/* codec.h
+ * header file for codec.cpp
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#ifndef AGL_CODEC_H_
+#define AGL_CODEC_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace agl {
+
+// file formats Image::save and Image::load understand:
+//   FORMAT_AUTO = pick from the file extension (.png, .raw or .rgb, .ppm,
+//       .qoi), PNG for anything else
+//   FORMAT_PNG = compressed with stb (or the built-in encoder, see
+//       PngOptions)
+//   FORMAT_RAW = packed RGB rows with no header, so loading needs the size
+//   FORMAT_PPM = binary PPM (P6): a short text header, then packed RGB rows
+//   FORMAT_QOI = "Quite OK Image" format, lossless and many times faster
+//       to write than PNG (https://qoiformat.org)
+enum ImageFormat {FORMAT_AUTO, FORMAT_PNG, FORMAT_RAW, FORMAT_PPM,
+    FORMAT_QOI};
+
+// return the format of a file from its extension (FORMAT_PNG if unknown)
+ImageFormat formatFromName(const std::string& filename);
+
+// filter applied to each row before it is compressed (PNG filter types):
+//   PNG_FILTER_NONE, SUB, UP, AVERAGE, PAETH = the same filter on every row
+//   PNG_FILTER_ADAPTIVE = per row, the filter whose output has the smallest
+//       sum of absolute values (like stb and libpng)
+enum PngFilter {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE, PNG_FILTER_PAETH, PNG_FILTER_ADAPTIVE};
+
+// settings for the built-in PNG encoder
+struct PngOptions {
+  // 0 stores the rows uncompressed, 1 is fastest, 9 is smallest
+  int level = 6;
+  PngFilter filter = PNG_FILTER_ADAPTIVE;
+  // number of threads that compress bands of rows (default 1); the file
+  // is the same for any number of threads
+  int threads = 1;
+  // rows per band; 0 (default) picks about 1 MB of pixels per band
+  int bandRows = 0;
+
+  // level 1 with the up filter on every core: larger files, written
+  // several times faster
+  static PngOptions fast();
+};
+
+/**
+ * @brief Encode RGB pixels as a PNG file in memory
+ *
+ * Bands of rows are filtered and deflated independently, on
+ * options.threads threads, and each band ends on a byte boundary so the
+ * bands join into one zlib stream (one IDAT chunk per band)
+ * @param pixels The first row of packed RGB pixels
+ * @param width The number of pixels per row
+ * @param height The number of rows
+ * @param stride The bytes from one row to the next (negative flips)
+ */
+std::vector<unsigned char> encodePng(const unsigned char* pixels, int width,
+    int height, int64_t stride, const PngOptions& options);
+
+// encode the pixels as with encodePng and write them to filename,
+// returning false if the file could not be written
+bool writePng(const std::string& filename, const unsigned char* pixels,
+    int width, int height, int64_t stride, const PngOptions& options);
+
+/**
+ * @brief Write a header and then count rows to filename
+ *
+ * The rows are written straight from memory in one call where the system
+ * allows it (writev on POSIX), without copying them into a file buffer
+ * @param header Bytes written before the rows (may be empty)
+ * @param rows The first row
+ * @param rowBytes The bytes of each row that are written
+ * @param count The number of rows
+ * @param stride The bytes from one row to the next (negative flips)
+ */
+bool writeRows(const std::string& filename, const std::string& header,
+    const unsigned char* rows, int64_t rowBytes, int count, int64_t stride);
+
+// return the header of a binary PPM file of the given size
+std::string ppmHeader(int width, int height);
+
+// parse the header of a binary PPM file with 8-bit channels (P6, maxval
+// 255) from its first n bytes, setting the size and the offset of the
+// first pixel byte; false if the header is anything else
+bool parsePpmHeader(const unsigned char* data, int64_t n, int& width,
+    int& height, int64_t& offset);
+
+// encode RGB pixels (rows stride bytes apart) as a QOI file in memory
+std::vector<unsigned char> encodeQoi(const unsigned char* pixels, int width,
+    int height, int64_t stride);
+
+// read the size from a QOI file's header; false if it is not QOI
+bool qoiSize(const unsigned char* data, int64_t n, int& width, int& height);
+
+// decode a QOI file into packed RGB rows stride bytes apart (alpha is
+// dropped); false if the data ends early or the header is invalid
+bool decodeQoi(const unsigned char* data, int64_t n, unsigned char* pixels,
+    int64_t stride);
+}  // namespace agl
+#endif  // AGL_CODEC_H_
@@ -21,7 +21,7 @@ int main(int argc, char** argv) {
     drawer.center(100 + i, 100 + i, i / 5);
   }
   drawer.end();
-  drawer.save("test_outline_circle.png");
+  drawer.saveAsync("test_outline_circle.png");
 
   drawer.begin(TRIANGLES);
   drawer.background(0, 0, 0);
@@ -37,7 +37,7 @@ int main(int argc, char** argv) {
     drawer.vertex(580 - i, 160 + i);
   }
   drawer.end();
-  drawer.save("test_outline_triangle.png");
+  drawer.saveAsync("test_outline_triangle.png");
   
   drawer.begin(CIRCLES);
   drawer.background(0, 0, 0);
@@ -46,21 +46,21 @@ int main(int argc, char** argv) {
     drawer.center(320, 320, i);
   }
   drawer.end();
-  drawer.save("test_circle.png");
+  drawer.saveAsync("test_circle.png");
 
   drawer.begin(ROSES);
   drawer.background(0, 0, 0);
   drawer.color(255, 255, 255);
   drawer.center(320, 320, 300, 5, 4);
   drawer.end();
-  drawer.save("test_rose.png");
+  drawer.saveAsync("test_rose.png");
 
   drawer.begin(MAURERS);
   drawer.background(0, 0, 0);
   drawer.color(255, 255, 255);
   drawer.center(320, 320, 300, 2, 29);
   drawer.end();
-  drawer.save("test_maurer.png");
+  drawer.saveAsync("test_maurer.png");
 
   drawer.begin(TRIANGLES);
   drawer.background(0, 0, 0);
@@ -100,7 +100,7 @@ int main(int argc, char** argv) {
   drawer.color(255, 255, 255);
   drawer.center(320, 320, 200, 6, 71);
   drawer.end();
-  drawer.save("exhibit1.png");
+  drawer.saveAsync("exhibit1.png");
 
   drawer.begin(TRIANGLES);
   drawer.background(0, 0, 0);
@@ -127,7 +127,7 @@ int main(int argc, char** argv) {
   drawer.color(255, 255, 255);
   drawer.center(320, 320, 200, 50, 59);
   drawer.end();
-  drawer.save("exhibit2.png");
+  drawer.saveAsync("exhibit2.png");
   
   drawer.begin(LINES);
   drawer.background(0, 51, 102);
@@ -160,5 +160,6 @@ int main(int argc, char** argv) {
     drawer.center(640, 0, i, 0, 0, true);
   }
   drawer.end();
-  drawer.save("exhibit3.png");
+  drawer.saveAsync("exhibit3.png");
+  drawer.waitForSaves();
 }
\ No newline at end of file
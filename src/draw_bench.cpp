@@ -0,0 +1,877 @@
+/* draw_bench.cpp
+ * times the Canvas rasterizers on scenes from draw_art.cpp and on synthetic
+ * stress scenes (thousands of filled shapes, tens of thousands of lines)
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include "canvas.h"
+#include "mapped_file.h"
+#include "pipeline.h"
+using namespace std;
+using namespace agl;
+
+// same shapes as exhibit1.png in draw_art
+void sceneExhibit1(Canvas& drawer) {
+  drawer.background(0, 0, 0);
+  drawer.begin(TRIANGLES);
+  for (int i = 0; i < 4; i++) {
+    int corners[5][2] = {{0, 0}, {640, 0}, {640, 640}, {0, 640}, {0, 0}};
+    drawer.color(255, 255, 255);
+    drawer.vertex(320, 320, true);
+    drawer.color(0, 0, 0);
+    drawer.vertex(corners[i][0], corners[i][1], true);
+    drawer.vertex(corners[i + 1][0], corners[i + 1][1], true);
+  }
+  drawer.end();
+  drawer.begin(ROSES);
+  drawer.color(50, 0, 0);
+  for (int amp = 200; amp <= 350; amp += 50) {
+    drawer.center(320, 320, amp, 6, 1);
+  }
+  drawer.color(100, 0, 0);
+  drawer.center(320, 320, 200, 6, 2);
+  drawer.color(200, 0, 0);
+  drawer.center(320, 320, 200, 6, 4);
+  drawer.end();
+  drawer.begin(MAURERS);
+  drawer.color(255, 255, 255);
+  drawer.center(320, 320, 200, 6, 71);
+  drawer.end();
+}
+
+// same shapes as exhibit3.png in draw_art
+void sceneExhibit3(Canvas& drawer) {
+  drawer.background(0, 51, 102);
+  drawer.begin(LINES);
+  for (int i = 40; i <= 640; i += 40) {
+    drawer.color(0, 51, 102);
+    drawer.vertex(0, i);
+    drawer.color(102, 102, 0);
+    drawer.vertex(i, 0);
+    drawer.vertex(0, i);
+    drawer.color(0, 51, 102);
+    drawer.vertex(i, 640);
+  }
+  drawer.end();
+  drawer.begin(CIRCLES);
+  drawer.color(255, 0, 0);
+  drawer.center(320, 320, 200, 0, 0, true);
+  for (int i = 400; i >= 100; i -= 50) {
+    drawer.color(200 - ((i / 50) * 12), 200 - ((i / 50) * 12), 0);
+    drawer.center(640, 0, i, 0, 0, true);
+  }
+  drawer.end();
+}
+
+// thousands of small filled triangles and circles over the whole canvas
+void sceneStress(Canvas& drawer) {
+  drawer.background(0, 0, 0);
+  drawer.begin(TRIANGLES);
+  for (int i = 0; i < 4000; i++) {
+    int x = (i * 37) % 620;
+    int y = (i * 91) % 620;
+    drawer.color(i % 256, (i * 3) % 256, (i * 7) % 256);
+    drawer.vertex(x, y, true);
+    drawer.color((i * 5) % 256, i % 256, (i * 11) % 256);
+    drawer.vertex(x + 20, y + 5, true);
+    drawer.vertex(x + 8, y + 20, true);
+  }
+  drawer.end();
+  drawer.begin(CIRCLES);
+  for (int i = 0; i < 2000; i++) {
+    drawer.color((i * 13) % 256, (i * 17) % 256, (i * 19) % 256);
+    drawer.center((i * 53) % 640, (i * 29) % 640, 4 + i % 12, 0, 0, true);
+  }
+  drawer.end();
+}
+
+// return the average milliseconds to draw the scene over several runs
+double timeScene(void (*scene)(Canvas&), Canvas& drawer, int runs) {
+  scene(drawer);  // warm up
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++) {
+    scene(drawer);
+  }
+  auto stop = chrono::steady_clock::now();
+  return chrono::duration<double, milli>(stop - start).count() / runs;
+}
+
+// compare the pixels of two canvases
+bool samePixels(const Canvas& a, const Canvas& b) {
+  const Image& x = a.image();
+  const Image& y = b.image();
+  return x.width() == y.width() && x.height() == y.height() &&
+      memcmp(x.data(), y.data(), sizeof(Pixel) * x.width() * x.height()) == 0;
+}
+
+// time the scene on a tiled canvas and compare it to the serial result
+void benchTiled(void (*scene)(Canvas&), const Canvas& serial, double base,
+    int n) {
+  Canvas tiled(640, 640);
+  tiled.setThreads(n);
+  double ms = timeScene(scene, tiled, 5);
+  cout << "  threads " << (n < 10 ? " " : "") << n << ": " << ms << " ms ("
+      << base / ms << "x)" << (samePixels(serial, tiled) ? "" : " MISMATCH")
+      << endl;
+}
+
+void benchThreads(const string& name, void (*scene)(Canvas&),
+    int maxThreads) {
+  Canvas serial(640, 640);
+  double base = timeScene(scene, serial, 5);
+  cout << name << endl;
+  cout << "  threads  1: " << base << " ms" << endl;
+  int n = 2;
+  for (; n <= maxThreads; n *= 2) {
+    benchTiled(scene, serial, base, n);
+  }
+  if (n / 2 != maxThreads && maxThreads > 1) {
+    benchTiled(scene, serial, base, maxThreads);
+  }
+}
+
+// short segments like the ones rose curves produce, plus long diagonals
+void sceneSegments(Canvas& drawer) {
+  drawer.begin(LINES);
+  for (int i = 0; i < 20000; i++) {
+    int x = (i * 37) % 630;
+    int y = (i * 91) % 630;
+    drawer.color(i % 256, (i * 3) % 256, 255);
+    drawer.vertex(x, y);
+    drawer.color(255, i % 256, (i * 7) % 256);
+    if (i % 10 == 0) {
+      drawer.vertex(639 - x, 639 - y);
+    } else {
+      drawer.vertex(x + i % 9, y + (i / 9) % 7);
+    }
+  }
+  drawer.end();
+}
+
+void benchLines() {
+  const int segments = 20000;
+  Canvas distance(640, 640);
+  distance.setLineShading(LINE_DISTANCE);
+  Canvas fixed(640, 640);
+  double slow = timeScene(sceneSegments, distance, 5);
+  double fast = timeScene(sceneSegments, fixed, 5);
+  cout << "lines" << endl;
+  cout << "  distance:    " << segments / slow * 1000 << " segments/s" << endl;
+  cout << "  fixed point: " << segments / fast * 1000 << " segments/s ("
+      << slow / fast << "x)" << endl;
+}
+
+// the original filled-circle loop: test the distance of every pixel in the
+// bounding square
+void distanceDisc(Image& image, int cx, int cy, int radius,
+    const Pixel& color) {
+  int x0 = max(cx - radius, 0);
+  int x1 = min(cx + radius, image.width() - 1);
+  int y0 = max(cy - radius, 0);
+  int y1 = min(cy + radius, image.height() - 1);
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      int distance = sqrt(pow(x - cx, 2) + pow(y - cy, 2));
+      if (distance <= radius) {
+        image.set(y, x, color);
+      }
+    }
+  }
+}
+
+void benchDiscs() {
+  const int discs = 50;
+  Pixel red = {255, 0, 0};
+  Image reference(640, 640);
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < discs; i++) {
+    distanceDisc(reference, 320, 320, 200, red);
+  }
+  auto stop = chrono::steady_clock::now();
+  double slow = chrono::duration<double, milli>(stop - start).count() / discs;
+
+  Canvas spans(640, 640);
+  spans.color(255, 0, 0);
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < discs; i++) {
+    spans.begin(CIRCLES);
+    spans.center(320, 320, 200, 0, 0, true);
+    spans.end();
+  }
+  stop = chrono::steady_clock::now();
+  double fast = chrono::duration<double, milli>(stop - start).count() / discs;
+
+  // both start from uninitialized pixels, so compare coverage on black
+  Canvas check(640, 640);
+  check.background(0, 0, 0);
+  check.color(255, 0, 0);
+  check.begin(CIRCLES);
+  check.center(320, 320, 200, 0, 0, true);
+  check.end();
+  Image expected(640, 640);
+  for (int i = 0; i < 640 * 640; i++) {
+    expected.set(i, Pixel{0, 0, 0});
+  }
+  distanceDisc(expected, 320, 320, 200, red);
+  bool same = memcmp(expected.data(), check.image().data(),
+      sizeof(Pixel) * 640 * 640) == 0;
+  cout << "filled disc, r = 200" << endl;
+  cout << "  distance: " << slow << " ms" << endl;
+  cout << "  spans:    " << fast << " ms (" << slow / fast << "x)"
+      << (same ? "" : " MISMATCH") << endl;
+}
+
+// roses of every size, from a few pixels across to the whole canvas
+void sceneRoses(Canvas& drawer) {
+  drawer.background(0, 0, 0);
+  drawer.begin(ROSES);
+  drawer.color(255, 255, 255);
+  for (int amp = 10; amp <= 310; amp += 50) {
+    drawer.center(320, 320, amp, 5, 4);
+    drawer.center(320, 320, amp, 7, 9);
+  }
+  drawer.center(100, 100, 20, 3, 29);
+  drawer.end();
+}
+
+// the rose scene at the given scale, antialiased or not
+void sceneRosesScaled(Canvas& drawer, int scale, bool antialias) {
+  drawer.background(0, 0, 0);
+  drawer.begin(ROSES, antialias);
+  drawer.color(255, 255, 255);
+  for (int amp = 10; amp <= 310; amp += 50) {
+    drawer.center(320 * scale, 320 * scale, amp * scale, 5, 4);
+    drawer.center(320 * scale, 320 * scale, amp * scale, 7, 9);
+  }
+  drawer.end();
+  drawer.begin(CIRCLES, antialias);
+  drawer.center(320 * scale, 320 * scale, 315 * scale);
+  drawer.end();
+}
+
+void benchSmooth() {
+  const int runs = 5;
+  Canvas aliased(640, 640);
+  Canvas smooth(640, 640);
+  Canvas large(2560, 2560);
+  double times[3] = {0, 0, 0};
+  for (int k = 0; k < runs; k++) {
+    auto start = chrono::steady_clock::now();
+    sceneRosesScaled(aliased, 1, false);
+    auto mid = chrono::steady_clock::now();
+    sceneRosesScaled(smooth, 1, true);
+    auto stop = chrono::steady_clock::now();
+    times[0] += chrono::duration<double, milli>(mid - start).count();
+    times[1] += chrono::duration<double, milli>(stop - mid).count();
+    // the old way to smooth curves: draw at 4x and scale down
+    start = chrono::steady_clock::now();
+    sceneRosesScaled(large, 4, false);
+    Image down = large.image().resize(640, 640);
+    stop = chrono::steady_clock::now();
+    times[2] += chrono::duration<double, milli>(stop - start).count();
+  }
+  cout << "roses and circle, 640x640" << endl;
+  cout << "  aliased:       " << times[0] / runs << " ms" << endl;
+  cout << "  antialiased:   " << times[1] / runs << " ms" << endl;
+  cout << "  4x + resize:   " << times[2] / runs << " ms" << endl;
+}
+
+void benchRoses(float tolerance) {
+  Canvas fixed(640, 640);
+  double slow = timeScene(sceneRoses, fixed, 5);
+  long slowSegments = fixed.segmentCount() / 6;  // warm up + 5 runs
+  Canvas adaptive(640, 640);
+  adaptive.setCurveTolerance(tolerance);
+  double fast = timeScene(sceneRoses, adaptive, 5);
+  long fastSegments = adaptive.segmentCount() / 6;
+  cout << "roses" << endl;
+  cout << "  361 * d steps:     " << slowSegments << " segments, " << slow
+      << " ms" << endl;
+  cout << "  tolerance " << tolerance << " px: " << fastSegments
+      << " segments, " << fast << " ms (" << slow / fast << "x)" << endl;
+}
+
+void benchClear() {
+  const int runs = 20;
+  Image frame(3840, 2160);
+  Pixel blue = {0, 51, 102};
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    for (int i = 0; i < frame.width() * frame.height(); i++) {
+      frame.set(i, blue);
+    }
+  }
+  auto stop = chrono::steady_clock::now();
+  double slow = chrono::duration<double, milli>(stop - start).count() / runs;
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    frame.fill(blue);
+  }
+  stop = chrono::steady_clock::now();
+  double fast = chrono::duration<double, milli>(stop - start).count() / runs;
+  cout << "4K clear" << endl;
+  cout << "  per pixel: " << slow << " ms" << endl;
+  cout << "  fill:      " << fast << " ms (" << slow / fast << "x)" << endl;
+}
+
+// time the per-pixel filters on a 4K frame stored in the given layout
+void benchLayout(const string& name, PixelLayout layout) {
+  const int runs = 5;
+  Image a(3840, 2160, layout);
+  Image b(3840, 2160, layout);
+  a.fill(Pixel{200, 120, 40});
+  b.fill(Pixel{30, 90, 250});
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    a.add(b);
+    a.subtract(b);
+    a.invert();
+    a.grayscale();
+    a.alphaBlend(b, 0.3f);
+  }
+  auto stop = chrono::steady_clock::now();
+  cout << "  " << name << chrono::duration<double, milli>(stop - start).count()
+      / runs << " ms" << endl;
+}
+
+// a chain of four filters on a 4K frame: returning new images vs writing
+// into two reused buffers
+void benchChain() {
+  const int runs = 5;
+  Image a(3840, 2160, RGBA8);
+  Image b(3840, 2160, RGBA8);
+  a.fill(Pixel{200, 120, 40});
+  b.fill(Pixel{30, 90, 250});
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    Image out = a.grayscale().blur().invert().alphaBlend(b, 0.3f);
+  }
+  auto stop = chrono::steady_clock::now();
+  double slow = chrono::duration<double, milli>(stop - start).count() / runs;
+  Image ping;
+  Image pong;
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    a.grayscaleInto(ping);
+    ping.blurInto(pong);
+    pong.invertInPlace();
+    pong.alphaBlendInPlace(b, 0.3f);
+  }
+  stop = chrono::steady_clock::now();
+  double fast = chrono::duration<double, milli>(stop - start).count() / runs;
+  cout << "4K grayscale, blur, invert, alphaBlend" << endl;
+  cout << "  new images:     " << slow << " ms" << endl;
+  cout << "  reused buffers: " << fast << " ms (" << slow / fast << "x)" << endl;
+}
+
+// a 5-step per-pixel chain on a 4K frame: one pass per filter vs the fused
+// pipeline, next to a plain copy of the frame (one read + one write pass)
+void benchPipeline(int maxThreads) {
+  const int runs = 5;
+  Image a(3840, 2160);
+  Image b(3840, 2160);
+  a.fill(Pixel{200, 120, 40});
+  b.fill(Pixel{30, 90, 250});
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    Image out = a.gammaCorrect(2.2f).grayscale().invert().add(b)
+        .alphaBlend(b, 0.3f);
+  }
+  auto stop = chrono::steady_clock::now();
+  double slow = chrono::duration<double, milli>(stop - start).count() / runs;
+  Pipeline chain(a);
+  chain.gammaCorrect(2.2f).grayscale().invert().add(b).alphaBlend(b, 0.3f);
+  Image out;
+  chain.runInto(out);  // warm up
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    chain.runInto(out);
+  }
+  stop = chrono::steady_clock::now();
+  double fast = chrono::duration<double, milli>(stop - start).count() / runs;
+  chain.setThreads(maxThreads);
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    chain.runInto(out);
+  }
+  stop = chrono::steady_clock::now();
+  double parallel = chrono::duration<double, milli>(stop - start).count() /
+      runs;
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    memcpy(out.data(), a.data(), sizeof(Pixel) * 3840 * 2160);
+  }
+  stop = chrono::steady_clock::now();
+  double copy = chrono::duration<double, milli>(stop - start).count() / runs;
+  cout << "4K gammaCorrect, grayscale, invert, add, alphaBlend" << endl;
+  cout << "  eager:    " << slow << " ms" << endl;
+  cout << "  pipeline: " << fast << " ms (" << slow / fast << "x)" << endl;
+  cout << "  pipeline, " << maxThreads << " threads: " << parallel << " ms"
+      << endl;
+  cout << "  memcpy:   " << copy << " ms" << endl;
+}
+
+// box blur on a 4K frame; the running sums should make the time flat in
+// the radius
+void benchBlur() {
+  Image a(3840, 2160);
+  for (int i = 0; i < a.width() * a.height(); i++) {
+    a.set(i, Pixel{(unsigned char) i, (unsigned char) (i / 7), 90});
+  }
+  Image out;
+  cout << "4K blur" << endl;
+  for (int radius : {1, 4, 16, 64}) {
+    auto start = chrono::steady_clock::now();
+    a.blurInto(out, radius);
+    auto stop = chrono::steady_clock::now();
+    cout << "  radius " << radius << ": "
+        << chrono::duration<double, milli>(stop - start).count() << " ms"
+        << endl;
+  }
+}
+
+// edge detection on a rendered 4K frame, in color and in gray
+void benchSobel() {
+  Image a(3840, 2160);
+  for (int i = 0; i < a.width() * a.height(); i++) {
+    a.set(i, Pixel{(unsigned char) i, (unsigned char) (i / 7),
+        (unsigned char) (i / 3840)});
+  }
+  Image gray = a.grayscale();
+  Image out;
+  cout << "4K sobelEdge" << endl;
+  const char* names[] = {"  exact:      ", "  L1:         ", "  exact gray: "};
+  for (int k = 0; k < 3; k++) {
+    auto start = chrono::steady_clock::now();
+    if (k == 2) {
+      gray.sobelEdgeInto(out);
+    } else {
+      a.sobelEdgeInto(out, k == 0 ? EDGE_EXACT : EDGE_L1);
+    }
+    auto stop = chrono::steady_clock::now();
+    cout << names[k] << chrono::duration<double, milli>(stop - start).count()
+        << " ms" << endl;
+  }
+}
+
+// gamma correction on a 4K frame through the cached table, next to a plain
+// copy of the frame
+void benchGamma() {
+  const int runs = 5;
+  Image a(3840, 2160);
+  for (int i = 0; i < a.width() * a.height(); i++) {
+    a.set(i, Pixel{(unsigned char) i, (unsigned char) (i / 7), 90});
+  }
+  Image out;
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    out = a.gammaCorrect(2.2f);
+  }
+  auto stop = chrono::steady_clock::now();
+  double gamma = chrono::duration<double, milli>(stop - start).count() / runs;
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    memcpy(out.data(), a.data(), sizeof(Pixel) * a.width() * a.height());
+  }
+  stop = chrono::steady_clock::now();
+  double copy = chrono::duration<double, milli>(stop - start).count() / runs;
+  cout << "4K gammaCorrect" << endl;
+  cout << "  table:  " << gamma << " ms" << endl;
+  cout << "  memcpy: " << copy << " ms" << endl;
+}
+
+void benchBlend() {
+  const int runs = 5;
+  Image a(3840, 2160);
+  Image b(3840, 2160);
+  for (int i = 0; i < a.width() * a.height(); i++) {
+    a.set(i, Pixel{(unsigned char) i, (unsigned char) (i / 7), 90});
+    b.set(i, Pixel{(unsigned char) (i / 3), 200, (unsigned char) (i >> 4)});
+  }
+  const char* names[] = {"add", "subtract", "multiply", "difference",
+      "lightest", "darkest", "alpha"};
+  Image out;
+  cout << "4K blend" << endl;
+  for (int mode = BLEND_ADD; mode <= BLEND_ALPHA; mode++) {
+    auto start = chrono::steady_clock::now();
+    for (int k = 0; k < runs; k++) {
+      a.blendInto(b, (BlendMode) mode, out, 100);
+    }
+    auto stop = chrono::steady_clock::now();
+    double ms = chrono::duration<double, milli>(stop - start).count() / runs;
+    cout << "  " << names[mode] << ": " << ms << " ms" << endl;
+  }
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    a.alphaBlendInto(b, 0.4f, out);
+  }
+  auto stop = chrono::steady_clock::now();
+  double ms = chrono::duration<double, milli>(stop - start).count() / runs;
+  cout << "  alphaBlend (float): " << ms << " ms" << endl;
+}
+
+// a few small translucent shapes, as in a HUD drawn over a frame
+void sceneOverlay(Canvas& drawer, bool translucent) {
+  for (int i = 0; i < 20; i++) {
+    if (translucent) {
+      drawer.color(255, 200, 0, 96);
+    } else {
+      drawer.color(255, 200, 0);
+    }
+    drawer.begin(CIRCLES);
+    drawer.center(200 + i * 170, 300 + (i % 5) * 300, 60, 0, 0, true);
+    drawer.end();
+    drawer.begin(TRIANGLES);
+    drawer.vertex(100 + i * 180, 1800, true);
+    drawer.vertex(180 + i * 180, 1800, true);
+    drawer.vertex(140 + i * 180, 1700, true);
+    drawer.end();
+  }
+}
+
+void benchOverlay() {
+  const int runs = 5;
+  Canvas frame(3840, 2160);
+  frame.background(30, 60, 90);
+  // two passes: draw the layer opaque on its own canvas, then blend it
+  // over the whole frame
+  Canvas layer(3840, 2160);
+  Image out;
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    layer.background(30, 60, 90);
+    sceneOverlay(layer, false);
+    frame.image().blendInto(layer.image(), BLEND_ALPHA, out, 96);
+  }
+  auto stop = chrono::steady_clock::now();
+  double layered = chrono::duration<double, milli>(stop - start).count() /
+      runs;
+  // one pass: blend while rasterizing, only on covered pixels
+  Canvas direct(3840, 2160);
+  double blended = 0;
+  for (int k = 0; k < runs; k++) {
+    direct.background(30, 60, 90);
+    start = chrono::steady_clock::now();
+    sceneOverlay(direct, true);
+    stop = chrono::steady_clock::now();
+    blended += chrono::duration<double, milli>(stop - start).count();
+  }
+  blended /= runs;
+  bool same = memcmp(out.data(), direct.image().data(),
+      sizeof(Pixel) * 3840 * 2160) == 0;
+  cout << "4K translucent overlay, 40 shapes" << endl;
+  cout << "  layer + alpha blend: " << layered << " ms" << endl;
+  cout << "  blended spans:       " << blended << " ms ("
+      << layered / blended << "x)" << (same ? "" : " MISMATCH") << endl;
+}
+
+// a 4K frame of gradients, flat fills and curves, like the draw_art output
+void scenePng(Canvas& drawer) {
+  drawer.background(20, 20, 40);
+  drawer.begin(TRIANGLES);
+  drawer.color(255, 0, 0);
+  drawer.vertex(0, 0, true);
+  drawer.color(0, 255, 0);
+  drawer.vertex(3839, 0, true);
+  drawer.color(0, 0, 255);
+  drawer.vertex(0, 2159, true);
+  drawer.end();
+  drawer.begin(CIRCLES);
+  for (int i = 0; i < 300; i++) {
+    drawer.color((i * 13) % 256, (i * 17) % 256, (i * 19) % 256);
+    drawer.center((i * 523) % 3840, (i * 291) % 2160, 10 + i % 60, 0, 0,
+        i % 2 == 0);
+  }
+  drawer.end();
+  drawer.begin(ROSES, true);
+  drawer.color(255, 255, 255);
+  drawer.center(2400, 1100, 900, 5, 4);
+  drawer.end();
+}
+
+// return the size of a file in bytes
+long fileSize(const string& filename) {
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+void benchPng(int maxThreads) {
+  const int runs = 3;
+  Canvas drawer(3840, 2160);
+  scenePng(drawer);
+  const Image& frame = drawer.image();
+  double megabytes = 3840.0 * 2160 * 3 / (1 << 20);
+  cout << "4K PNG save (" << megabytes << " MB of pixels)" << endl;
+  auto report = [&](const string& name, double ms, const string& file) {
+    Image check;
+    bool same = check.load(file) && memcmp(check.data(), frame.data(),
+        sizeof(Pixel) * 3840 * 2160) == 0;
+    cout << "  " << name << megabytes / (ms / 1000) << " MB/s, "
+        << fileSize(file) / 1024 << " KB" << (same ? "" : " MISMATCH")
+        << endl;
+  };
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    frame.save("bench-stb.png");
+  }
+  auto stop = chrono::steady_clock::now();
+  report("stb:                   ",
+      chrono::duration<double, milli>(stop - start).count() / runs,
+      "bench-stb.png");
+  PngOptions options;
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    options.threads = threads;
+    start = chrono::steady_clock::now();
+    for (int k = 0; k < runs; k++) {
+      frame.save("bench-png.png", options);
+    }
+    stop = chrono::steady_clock::now();
+    string name = "level 6, " + to_string(threads) + " thread(s): ";
+    name.resize(23, ' ');
+    report(name, chrono::duration<double, milli>(stop - start).count() /
+        runs, "bench-png.png");
+  }
+  options = PngOptions::fast();
+  options.threads = min(options.threads, maxThreads);
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    frame.save("bench-fast.png", options);
+  }
+  stop = chrono::steady_clock::now();
+  string name = "fast, " + to_string(options.threads) + " thread(s): ";
+  name.resize(23, ' ');
+  report(name, chrono::duration<double, milli>(stop - start).count() / runs,
+      "bench-fast.png");
+  remove("bench-stb.png");
+  remove("bench-png.png");
+  remove("bench-fast.png");
+}
+
+void benchFormats() {
+  const int runs = 3;
+  Canvas drawer(3840, 2160);
+  scenePng(drawer);
+  const Image& frame = drawer.image();
+  cout << "4K save and load by format" << endl;
+  auto time = [&](const string& name, const string& file, ImageFormat format) {
+    auto start = chrono::steady_clock::now();
+    for (int k = 0; k < runs; k++) {
+      if (format == FORMAT_AUTO) {
+        frame.save(file, PngOptions::fast());
+      } else {
+        frame.save(file, format);
+      }
+    }
+    auto stop = chrono::steady_clock::now();
+    double saveMs = chrono::duration<double, milli>(stop - start).count() /
+        runs;
+    Image check;
+    start = chrono::steady_clock::now();
+    for (int k = 0; k < runs; k++) {
+      if (format == FORMAT_RAW) {
+        check.loadRaw(file, 3840, 2160);
+      } else {
+        check.load(file);
+      }
+    }
+    stop = chrono::steady_clock::now();
+    double loadMs = chrono::duration<double, milli>(stop - start).count() /
+        runs;
+    bool same = check.width() == 3840 && check.height() == 2160 &&
+        memcmp(check.data(), frame.data(), sizeof(Pixel) * 3840 * 2160) == 0;
+    cout << "  " << name << "save " << saveMs << " ms, load " << loadMs
+        << " ms, " << fileSize(file) / 1024 << " KB"
+        << (same ? "" : " MISMATCH") << endl;
+    remove(file.c_str());
+  };
+  time("png (stb):  ", "bench-format.png", FORMAT_PNG);
+  time("png (fast): ", "bench-format-fast.png", FORMAT_AUTO);
+  time("qoi:        ", "bench-format.qoi", FORMAT_QOI);
+  time("ppm:        ", "bench-format.ppm", FORMAT_PPM);
+  time("raw:        ", "bench-format.raw", FORMAT_RAW);
+}
+
+void benchAsync(int maxThreads) {
+  const int frames = 6;
+  Canvas drawer(3840, 2160);
+  cout << "4K draw + save, " << frames << " frames" << endl;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    scenePng(drawer);
+    drawer.save("bench-async-" + to_string(i) + ".png");
+  }
+  auto stop = chrono::steady_clock::now();
+  double syncMs = chrono::duration<double, milli>(stop - start).count();
+  cout << "  save:                   " << syncMs << " ms" << endl;
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    drawer.setSaveThreads(threads);
+    vector<future<bool>> written;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+      scenePng(drawer);
+      written.push_back(drawer.saveAsync("bench-async-" + to_string(i) +
+          ".png"));
+    }
+    drawer.waitForSaves();
+    stop = chrono::steady_clock::now();
+    bool ok = true;
+    for (future<bool>& f : written) {
+      ok = f.get() && ok;
+    }
+    string name = "saveAsync, " + to_string(threads) + " thread(s): ";
+    name.resize(24, ' ');
+    cout << "  " << name
+        << chrono::duration<double, milli>(stop - start).count() << " ms"
+        << (ok ? "" : " FAILED") << endl;
+  }
+  for (int i = 0; i < frames; i++) {
+    remove(("bench-async-" + to_string(i) + ".png").c_str());
+  }
+}
+
+void benchViews() {
+  const int runs = 20;
+  const int width = 16384;
+  const int height = 4096;
+  Image texture(width, height);
+  texture.fill(Pixel{40, 80, 120});
+  for (int i = 0; i < 64; i++) {
+    texture.fillRect((i * 2749) % width, (i * 1117) % height, 700, 300,
+        Pixel{(unsigned char) (i * 4), 200, (unsigned char) (255 - i * 4)});
+  }
+  texture.save("bench-texture.ppm");
+  cout << "512x512 tile of a " << width << "x" << height << " texture"
+      << endl;
+  Image tile;
+  auto start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    tile = texture.subimage(9000, 2000, 512, 512);
+  }
+  auto stop = chrono::steady_clock::now();
+  cout << "  subimage copy:         "
+      << chrono::duration<double, milli>(stop - start).count() / runs
+      << " ms" << endl;
+  ImageView view;
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    view = texture.view(9000, 2000, 512, 512);
+  }
+  stop = chrono::steady_clock::now();
+  cout << "  view:                  "
+      << chrono::duration<double, milli>(stop - start).count() / runs
+      << " ms" << endl;
+  Image frame(512, 512);
+  frame.fill(Pixel{128, 128, 128});
+  Image blended;
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    Image loaded;
+    loaded.load("bench-texture.ppm");
+    frame.blendInto(loaded.subimage(9000, 2000, 512, 512), BLEND_MULTIPLY,
+        blended);
+  }
+  stop = chrono::steady_clock::now();
+  cout << "  load + crop + blend:   "
+      << chrono::duration<double, milli>(stop - start).count() / runs
+      << " ms" << endl;
+  Image mapped;
+  start = chrono::steady_clock::now();
+  for (int k = 0; k < runs; k++) {
+    MappedFile file("bench-texture.ppm");
+    frame.blendInto(file.ppmView().view(9000, 2000, 512, 512),
+        BLEND_MULTIPLY, mapped);
+  }
+  stop = chrono::steady_clock::now();
+  cout << "  map + view + blend:    "
+      << chrono::duration<double, milli>(stop - start).count() / runs
+      << " ms" << (memcmp(mapped.data(), blended.data(), 512 * 512 * 3) == 0 ?
+      "" : " MISMATCH") << endl;
+  remove("bench-texture.ppm");
+}
+
+void benchStream(int maxThreads) {
+  const int width = 8192;
+  const int height = 4096;
+  Image map(width, height);
+  map.fill(Pixel{30, 90, 60});
+  for (int i = 0; i < 200; i++) {
+    map.fillRect((i * 2749) % width, (i * 1117) % height, 400, 150,
+        Pixel{(unsigned char) (i * 7), 240, (unsigned char) (i * 3)});
+  }
+  map.save("bench-map.ppm");
+  cout << width << "x" << height << " .ppm blur + glow + sobelEdge" << endl;
+  auto start = chrono::steady_clock::now();
+  Image loaded;
+  loaded.load("bench-map.ppm");
+  loaded.blur().glow(200).sobelEdge().save("bench-map-whole.ppm");
+  auto stop = chrono::steady_clock::now();
+  cout << "  whole image in memory:  "
+      << chrono::duration<double, milli>(stop - start).count() << " ms"
+      << endl;
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    start = chrono::steady_clock::now();
+    Pipeline stream("bench-map.ppm");
+    stream.blur().glow(200).sobelEdge().setThreads(threads);
+    stream.runToFile("bench-map-stream.ppm");
+    stop = chrono::steady_clock::now();
+    MappedFile whole("bench-map-whole.ppm");
+    MappedFile streamed("bench-map-stream.ppm");
+    bool same = whole.size() == streamed.size() &&
+        memcmp(whole.data(), streamed.data(), whole.size()) == 0;
+    string name = "streamed, " + to_string(threads) + " thread(s): ";
+    name.resize(24, ' ');
+    cout << "  " << name
+        << chrono::duration<double, milli>(stop - start).count() << " ms"
+        << (same ? "" : " MISMATCH") << endl;
+  }
+  remove("bench-map.ppm");
+  remove("bench-map-whole.ppm");
+  remove("bench-map-stream.ppm");
+}
+
+int main(int argc, char** argv) {
+  // optional first argument overrides the number of cores to scale up to
+  int maxThreads = max((int) thread::hardware_concurrency(), 1);
+  if (argc > 1) {
+    maxThreads = max(atoi(argv[1]), 1);
+  }
+  benchThreads("exhibit1", sceneExhibit1, maxThreads);
+  benchThreads("exhibit3", sceneExhibit3, maxThreads);
+  benchThreads("stress", sceneStress, maxThreads);
+  benchLines();
+  benchDiscs();
+  benchRoses(0.5f);
+  benchSmooth();
+  benchClear();
+  cout << "4K add + subtract + invert + grayscale + alphaBlend" << endl;
+  benchLayout("packed RGB: ", PACKED_RGB);
+  benchLayout("RGBA8:      ", RGBA8);
+  benchLayout("planar:     ", PLANAR);
+  benchChain();
+  benchPipeline(maxThreads);
+  benchBlur();
+  benchSobel();
+  benchGamma();
+  benchBlend();
+  benchOverlay();
+  benchPng(maxThreads);
+  benchFormats();
+  benchAsync(maxThreads);
+  benchViews();
+  benchStream(maxThreads);
+  return 0;
+}
@@ -65,5 +65,52 @@ int main(int argc, char** argv)
    drawer.end();
    drawer.save("quad.png");
 
-   return 0;
+   int failures = 0;
+
+   // translucent outlined triangle: each corner is shared by two edges
+   // but must be blended once, so no pixel passes 128 on black (twice
+   // would give 192)
+   LineShading shadings[] = {LINE_FIXED_POINT, LINE_DISTANCE};
+   for (LineShading shading : shadings) {
+      drawer.setLineShading(shading);
+      drawer.background(0, 0, 0);
+      drawer.begin(TRIANGLES);
+      drawer.color(255, 255, 255, 128);
+      drawer.vertex(10, 10);
+      drawer.vertex(90, 50);
+      drawer.vertex(30, 90);
+      drawer.end();
+      const Image& image = drawer.image();
+      int bad = 0;
+      for (int i = 0; i < image.height(); i++) {
+         for (int j = 0; j < image.width(); j++) {
+            Pixel p = image.get(i, j);
+            bad += p.r > 128;
+         }
+      }
+      int corners[3][2] = {{10, 10}, {50, 90}, {90, 30}};  // row, column
+      for (auto& c : corners) {
+         bad += image.get(c[0], c[1]).r != 128;
+      }
+      if (bad > 0) {
+         cout << "Error: translucent triangle outline has " << bad
+            << " pixels blended twice or missing" << endl;
+         failures++;
+      }
+   }
+   drawer.setLineShading(LINE_FIXED_POINT);
+
+   // a window of 3000 x 3000 pixels sums to more than an int holds
+   Image white(3000, 3000);
+   white.fill(Pixel{255, 255, 255});
+   Image blurred = white.blur(3000);
+   Pixel center = blurred.get(1500, 1500);
+   Pixel corner = blurred.get(0, 0);
+   if (center.r != 255 || center.b != 255 || corner.r != 255 ||
+       corner.b != 255) {
+      cout << "Error: blur(3000) of a white image is not white" << endl;
+      failures++;
+   }
+
+   return failures == 0 ? 0 : 1;
 }
@@ -14,7 +14,20 @@
 
 #include "image.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "mapped_file.h"
+#include "simd.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 #define STB_IMAGE_IMPLEMENTATION
@@ -22,30 +35,496 @@
 
 namespace agl {
 
+// number of bytes one pixel uses in the given layout (per plane if planar)
+static int bytesPerPixel(PixelLayout layout) {
+  if (layout == PACKED_RGB) {
+    return 3;
+  } else if (layout == RGBA8) {
+    return 4;
+  }
+  return 1;
+}
+
+// number of bytes in one plane of a planar image; planes are padded to whole
+// cache lines so that each one starts 64-byte aligned
+static int64_t planeStride(int width, int height) {
+  return (((int64_t) width * height + 63) / 64) * 64;
+}
+
+// helper function to allocate bytes on a cache line (64-byte) boundary,
+// rounded up to whole cache lines so vector loops never read past the end
+// throws std::bad_alloc on failure, like the new[] it replaces
+static unsigned char* alignedAlloc(size_t bytes) {
+  size_t size = (std::max(bytes, (size_t) 1) + 63) / 64 * 64;
+  void* p = NULL;
+#ifdef _WIN32
+  p = _aligned_malloc(size, 64);
+#else
+  if (posix_memalign(&p, 64, size) != 0) {
+    p = NULL;
+  }
+#endif
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return (unsigned char*) p;
+}
+
+// helper function to free memory from alignedAlloc
+static void alignedFree(unsigned char* p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+// helper function to set count pixels starting at dst to color c
+static void fillPixels(struct Pixel* dst, int64_t count, const Pixel& c) {
+  if (count <= 0) {
+    return;
+  }
+  if (c.r == c.g && c.g == c.b) {
+    // gray (including black and white) is one repeated byte
+    memset(dst, c.r, sizeof(struct Pixel) * count);
+    return;
+  }
+  int64_t i = 0;
+#ifdef AGL_SSE2
+  // 16 pixels are exactly 48 bytes, i.e. three 16-byte stores
+  unsigned char pattern[48];
+  for (int k = 0; k < 16; k++) {
+    pattern[k * 3] = c.r;
+    pattern[k * 3 + 1] = c.g;
+    pattern[k * 3 + 2] = c.b;
+  }
+  __m128i p0 = _mm_loadu_si128((const __m128i*) pattern);
+  __m128i p1 = _mm_loadu_si128((const __m128i*) (pattern + 16));
+  __m128i p2 = _mm_loadu_si128((const __m128i*) (pattern + 32));
+  unsigned char* out = (unsigned char*) dst;
+  for (; i + 16 <= count; i += 16) {
+    _mm_storeu_si128((__m128i*) (out + i * 3), p0);
+    _mm_storeu_si128((__m128i*) (out + i * 3 + 16), p1);
+    _mm_storeu_si128((__m128i*) (out + i * 3 + 32), p2);
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] = c;
+  }
+}
+
+// helper to blend one channel value a with b (see BlendMode)
+static unsigned char blendChannel(int a, int b, BlendMode mode, int alpha) {
+  switch (mode) {
+    case BLEND_ADD:
+      return std::min(a + b, 255);
+    case BLEND_SUBTRACT:
+      return std::max(a - b, 0);
+    case BLEND_MULTIPLY:
+      return std::min(a * b, 255);
+    case BLEND_DIFFERENCE:
+      return std::abs(a - b);
+    case BLEND_LIGHTEST:
+      return std::max(a, b);
+    case BLEND_DARKEST:
+      return std::min(a, b);
+    default: {
+      // round(x / 255) exactly for 0 <= x <= 255 * 255
+      int x = b * alpha + a * (255 - alpha) + 128;
+      return (x + (x >> 8)) >> 8;
+    }
+  }
+}
+
+#ifdef AGL_SSE2
+// the 16-bit part of multiply and alpha: 8 channel values per vector
+template <BlendMode Mode>
+static __m128i blendWide(__m128i a, __m128i b, __m128i alpha, __m128i beta) {
+  if (Mode == BLEND_MULTIPLY) {
+    // products are below 2^16; subtracting the excess over 255 clamps them
+    __m128i product = _mm_mullo_epi16(a, b);
+    return _mm_sub_epi16(product,
+        _mm_subs_epu16(product, _mm_set1_epi16(255)));
+  }
+  // same rounding division by 255 as blendChannel; every step stays below
+  // 2^16, so the 16-bit lanes never wrap
+  __m128i x = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(b, alpha),
+      _mm_mullo_epi16(a, beta)), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// blend 16 channel values of a with 16 of b
+template <BlendMode Mode>
+static __m128i blendVector(__m128i a, __m128i b, __m128i alpha,
+    __m128i beta) {
+  switch (Mode) {
+    case BLEND_ADD:
+      return _mm_adds_epu8(a, b);
+    case BLEND_SUBTRACT:
+      return _mm_subs_epu8(a, b);
+    case BLEND_DIFFERENCE:
+      // one of the two saturating differences is always 0
+      return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    case BLEND_LIGHTEST:
+      return _mm_max_epu8(a, b);
+    case BLEND_DARKEST:
+      return _mm_min_epu8(a, b);
+    default: {
+      __m128i zero = _mm_setzero_si128();
+      __m128i lo = blendWide<Mode>(_mm_unpacklo_epi8(a, zero),
+          _mm_unpacklo_epi8(b, zero), alpha, beta);
+      __m128i hi = blendWide<Mode>(_mm_unpackhi_epi8(a, zero),
+          _mm_unpackhi_epi8(b, zero), alpha, beta);
+      return _mm_packus_epi16(lo, hi);
+    }
+  }
+}
+#endif
+
+// helper to blend count bytes of a and b into dst; with the same layout on
+// both sides, byte k of one image pairs with byte k of the other, so the
+// channels never need to be separated
+template <BlendMode Mode>
+static void blendModeBytes(const unsigned char* a, const unsigned char* b,
+    unsigned char* dst, int64_t count, int alpha) {
+  int64_t i = 0;
+#ifdef AGL_SSE2
+  __m128i va = _mm_set1_epi16(alpha);
+  __m128i vb = _mm_set1_epi16(255 - alpha);
+  for (; i + 16 <= count; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+    __m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+    _mm_storeu_si128((__m128i*) (dst + i), blendVector<Mode>(x, y, va, vb));
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] = blendChannel(a[i], b[i], Mode, alpha);
+  }
+}
+
+static void blendModeBytes(const unsigned char* a, const unsigned char* b,
+    unsigned char* dst, int64_t count, BlendMode mode, int alpha) {
+  switch (mode) {
+    case BLEND_ADD:
+      return blendModeBytes<BLEND_ADD>(a, b, dst, count, alpha);
+    case BLEND_SUBTRACT:
+      return blendModeBytes<BLEND_SUBTRACT>(a, b, dst, count, alpha);
+    case BLEND_MULTIPLY:
+      return blendModeBytes<BLEND_MULTIPLY>(a, b, dst, count, alpha);
+    case BLEND_DIFFERENCE:
+      return blendModeBytes<BLEND_DIFFERENCE>(a, b, dst, count, alpha);
+    case BLEND_LIGHTEST:
+      return blendModeBytes<BLEND_LIGHTEST>(a, b, dst, count, alpha);
+    case BLEND_DARKEST:
+      return blendModeBytes<BLEND_DARKEST>(a, b, dst, count, alpha);
+    default:
+      return blendModeBytes<BLEND_ALPHA>(a, b, dst, count, alpha);
+  }
+}
+
+#ifdef AGL_AVX2
+// lookupBytes with vpshufb, which only indexes 16 entries: the table is
+// split into 16 rows by the high nibble, and every byte is looked up in
+// each row. Bytes whose high nibble isn't the row's are pushed out of range
+// (bit 7 set), which vpshufb reads as 0, so OR-ing the rows gives the
+// lookup. Returns the number of bytes done
+AGL_TARGET_AVX2
+static int64_t lookupBytesAVX2(const uint8_t table[256],
+    const unsigned char* a, unsigned char* dst, int64_t count) {
+  __m256i rows[16];
+  for (int h = 0; h < 16; h++) {
+    rows[h] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*) (table + h * 16)));
+  }
+  __m256i bias = _mm256_set1_epi8(0x70);
+  __m256i step = _mm256_set1_epi8(16);
+  int64_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+    __m256i out = _mm256_setzero_si256();
+    for (int h = 0; h < 16; h++) {
+      // x - 16h is 0..15 for the bytes in row h; the saturating add keeps
+      // those below 128 and takes every other byte to 128 or more
+      __m256i index = _mm256_adds_epu8(x, bias);
+      out = _mm256_or_si256(out, _mm256_shuffle_epi8(rows[h], index));
+      x = _mm256_sub_epi8(x, step);
+    }
+    _mm256_storeu_si256((__m256i*) (dst + i), out);
+  }
+  return i;
+}
+#endif
+
+#ifdef AGL_VBMI
+// lookupBytes with vpermi2b, which indexes two registers, i.e. 128 entries:
+// one lookup in each half of the table, picked by bit 7 of the byte.
+// Returns the number of bytes done
+AGL_TARGET_VBMI
+static int64_t lookupBytesVBMI(const uint8_t table[256],
+    const unsigned char* a, unsigned char* dst, int64_t count) {
+  __m512i t0 = _mm512_loadu_si512(table);
+  __m512i t1 = _mm512_loadu_si512(table + 64);
+  __m512i t2 = _mm512_loadu_si512(table + 128);
+  __m512i t3 = _mm512_loadu_si512(table + 192);
+  int64_t i = 0;
+  for (; i + 64 <= count; i += 64) {
+    __m512i x = _mm512_loadu_si512(a + i);
+    __m512i low = _mm512_permutex2var_epi8(t0, x, t1);
+    __m512i high = _mm512_permutex2var_epi8(t2, x, t3);
+    _mm512_storeu_si512(dst + i,
+        _mm512_mask_blend_epi8(_mm512_movepi8_mask(x), low, high));
+  }
+  return i;
+}
+#endif
+
+// helper for lookupBytes: the widest table lookup the CPU has. Returns the
+// number of bytes done
+static int64_t lookupBytesVector(const uint8_t table[256],
+    const unsigned char* a, unsigned char* dst, int64_t count) {
+#ifdef AGL_VBMI
+  if (aglHasVBMI()) {
+    return lookupBytesVBMI(table, a, dst, count);
+  }
+#endif
+#ifdef AGL_AVX2
+  if (aglHasAVX2()) {
+    return lookupBytesAVX2(table, a, dst, count);
+  }
+#endif
+  return 0;
+}
+
+// dst = table[a] for count bytes
+static void lookupBytes(const uint8_t table[256], const unsigned char* a,
+    unsigned char* dst, int64_t count) {
+  int64_t i = 0;
+  // a table that flips the same bits of every value (invert, or the
+  // identity) is a single XOR
+  bool flip = true;
+  for (int v = 0; v < 256 && flip; v++) {
+    flip = table[v] == (v ^ table[0]);
+  }
+  if (!flip) {
+    i = lookupBytesVector(table, a, dst, count);
+  } else {
+#ifdef AGL_SSE2
+    __m128i bits = _mm_set1_epi8((char) table[0]);
+    for (; i + 16 <= count; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+      _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(x, bits));
+    }
+#endif
+  }
+  for (; i < count; i++) {
+    dst[i] = table[a[i]];
+  }
+}
+
+// dst = a & mask, where mask repeats every 48 bytes (16 packed RGB or 12
+// RGBA8 pixels)
+static void maskBytes(const unsigned char* a, const unsigned char mask[48],
+    unsigned char* dst, int64_t count) {
+  int64_t i = 0;
+#ifdef AGL_SSE2
+  __m128i m[3];
+  for (int k = 0; k < 3; k++) {
+    m[k] = _mm_loadu_si128((const __m128i*) (mask + k * 16));
+  }
+  for (; i + 48 <= count; i += 48) {
+    for (int k = 0; k < 3; k++) {
+      __m128i x = _mm_loadu_si128((const __m128i*) (a + i + k * 16));
+      _mm_storeu_si128((__m128i*) (dst + i + k * 16), _mm_and_si128(x, m[k]));
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] = a[i] & mask[i % 48];
+  }
+}
+
+#ifdef AGL_SSE2
+// round non-negative floats half away from zero, like round()
+static __m128i roundLanes(__m128 v) {
+  __m128i t = _mm_cvttps_epi32(v);
+  __m128 frac = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+  // the compare mask is -1 where the fraction rounds up
+  __m128i up = _mm_castps_si128(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)));
+  return _mm_sub_epi32(t, up);
+}
+
+// blend 4 bytes (as 32-bit lanes) the same way as alphaBlendPixel
+static __m128i blendLanes(__m128i orig, __m128i other, __m128 alpha,
+    __m128 beta) {
+  __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(other), alpha);
+  __m128 y = _mm_mul_ps(_mm_cvtepi32_ps(orig), beta);
+  return roundLanes(_mm_add_ps(x, y));
+}
+#endif
+
+// dst = round(b * alpha + a * (1 - alpha))
+static void blendBytes(const unsigned char* a, const unsigned char* b,
+    unsigned char* dst, int64_t count, float alpha) {
+  int64_t i = 0;
+#ifdef AGL_SSE2
+  __m128 va = _mm_set1_ps(alpha);
+  __m128 vb = _mm_set1_ps(1 - alpha);
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+    __m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+    // widen 16 bytes to four groups of 32-bit lanes
+    __m128i x0 = _mm_unpacklo_epi8(x, zero);
+    __m128i x1 = _mm_unpackhi_epi8(x, zero);
+    __m128i y0 = _mm_unpacklo_epi8(y, zero);
+    __m128i y1 = _mm_unpackhi_epi8(y, zero);
+    __m128i r0 = blendLanes(_mm_unpacklo_epi16(x0, zero),
+        _mm_unpacklo_epi16(y0, zero), va, vb);
+    __m128i r1 = blendLanes(_mm_unpackhi_epi16(x0, zero),
+        _mm_unpackhi_epi16(y0, zero), va, vb);
+    __m128i r2 = blendLanes(_mm_unpacklo_epi16(x1, zero),
+        _mm_unpacklo_epi16(y1, zero), va, vb);
+    __m128i r3 = blendLanes(_mm_unpackhi_epi16(x1, zero),
+        _mm_unpackhi_epi16(y1, zero), va, vb);
+    __m128i lo = _mm_packs_epi32(r0, r1);
+    __m128i hi = _mm_packs_epi32(r2, r3);
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+  }
+#endif
+  float beta = 1 - alpha;
+  for (; i < count; i++) {
+    dst[i] = round((b[i] * alpha) + (a[i] * beta));
+  }
+}
+
+#ifdef AGL_SSE2
+// glowBytes of 8 bytes a and highlights w, given as 16-bit lanes
+static __m128i glowWords(__m128i a, __m128i w) {
+  __m128i inv = _mm_sub_epi16(_mm_set1_epi16(510), w);
+  __m128i half = _mm_set1_epi32(255);
+  // w * w + a * (510 - w), plus half the divisor, in 32-bit lanes
+  __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(w, a),
+      _mm_unpacklo_epi16(w, inv)), half);
+  __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(w, a),
+      _mm_unpackhi_epi16(w, inv)), half);
+  // x / 510 = (x / 2) / 255, and x / 2 fits an unsigned 16-bit lane; it is
+  // packed through the signed range and shifted back
+  __m128i bias = _mm_set1_epi32(32768);
+  __m128i y = _mm_add_epi16(_mm_packs_epi32(
+      _mm_sub_epi32(_mm_srli_epi32(lo, 1), bias),
+      _mm_sub_epi32(_mm_srli_epi32(hi, 1), bias)), _mm_set1_epi16(-32768));
+  return _mm_srli_epi16(_mm_mulhi_epu16(y, _mm_set1_epi16(-32639)), 7);
+}
+#endif
+
+// helper for glow: blend each byte a of the image towards the matching byte
+// w of its blurred highlights with alpha = (r + g + b) / (6 * 255). The
+// highlights are gray, so that is w / 510, and
+// dst = round((w * w + a * (510 - w)) / 510), in fixed point like
+// BLEND_ALPHA
+static void glowBytes(const unsigned char* a, const unsigned char* w,
+    unsigned char* dst, int64_t count) {
+  int64_t i = 0;
+#ifdef AGL_SSE2
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+    __m128i y = _mm_loadu_si128((const __m128i*) (w + i));
+    __m128i lo = glowWords(_mm_unpacklo_epi8(x, zero),
+        _mm_unpacklo_epi8(y, zero));
+    __m128i hi = glowWords(_mm_unpackhi_epi8(x, zero),
+        _mm_unpackhi_epi8(y, zero));
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] = (w[i] * w[i] + a[i] * (510 - w[i]) + 255) / 510;
+  }
+}
+
+// weighted average used by grayscale
+static unsigned char grayValue(const Pixel& p) {
+  return round((p.r * 0.3) + (p.g * 0.59) + (p.b * 0.11));
+}
+
+#ifdef AGL_SSE2
+// grayValue of 8 pixels given the weighted sums 30r + 59g + 11b as 16-bit
+// lanes; away from ties, (sum + 50) / 100 is exactly what the double
+// expression rounds to, and the division is a multiply by 2^22 / 100.
+// Sets ties when a sum ends in 50, where the double constants can round
+// either way, so the caller must use grayValue for those pixels
+static __m128i graySums(__m128i sum, bool& ties) {
+  __m128i x = _mm_add_epi16(sum, _mm_set1_epi16(50));
+  __m128i q = _mm_srli_epi16(_mm_mulhi_epu16(x, _mm_set1_epi16(-23592)), 6);
+  __m128i exact = _mm_cmpeq_epi16(_mm_mullo_epi16(q, _mm_set1_epi16(100)), x);
+  ties = _mm_movemask_epi8(exact) != 0;
+  return q;
+}
+
+// 30r + 59g + 11b of 8 pixels given as 16-bit lanes of r, g and b
+static __m128i graySum(__m128i r, __m128i g, __m128i b) {
+  return _mm_add_epi16(_mm_add_epi16(
+      _mm_mullo_epi16(r, _mm_set1_epi16(30)),
+      _mm_mullo_epi16(g, _mm_set1_epi16(59))),
+      _mm_mullo_epi16(b, _mm_set1_epi16(11)));
+}
+
+// 30r + 59g + 11b of the 4 RGBA8 pixels in p, as 32-bit lanes
+static __m128i graySumRGBA(__m128i p) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i weights = _mm_setr_epi16(30, 59, 11, 0, 30, 59, 11, 0);
+  // (30r + 59g, 11b) pairs for each pixel, then the pairs added up
+  __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights);
+  __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights);
+  return _mm_madd_epi16(_mm_packs_epi32(lo, hi), _mm_set1_epi16(1));
+}
+#endif
+
 // helper function to free pixels
 void Image::resetPixels() {
   if (_pixels != NULL) {
     _width = 0;
     _height = 0;
     _components = 0;
-    if (_use_stbi_free) {
-      // allocated with stbi_load, so must free with stbi_image_free
-      stbi_image_free(_pixels);
-      _use_stbi_free = false;
-    } else {
-      // regular array deallocation
-      delete[] _pixels;
-    }
+    alignedFree(_pixels);
     _pixels = NULL;
   }
 }
 
+void Image::allocPixels() {
+  _pixels = alignedAlloc(byteSize());
+}
+
+void Image::reshape(int width, int height, PixelLayout layout) {
+  if (_pixels != NULL && _width == width && _height == height &&
+      _layout == layout) {
+    // already the right buffer, reuse it
+    return;
+  }
+  resetPixels();
+  _width = width;
+  _height = height;
+  _layout = layout;
+  allocPixels();
+}
+
+int64_t Image::byteSize() const {
+  if (_layout == PLANAR) {
+    return planeStride(_width, _height) * 3;
+  }
+  return (int64_t) _width * _height * bytesPerPixel(_layout);
+}
+
 // if no width/height provided, no need set instance variables
 Image::Image() {  }
 
 Image::Image(int width, int height): _width(width), _height(height) {
-  resetPixels();
-  _pixels = new struct Pixel[width * height];
+  allocPixels();
+}
+
+Image::Image(int width, int height, PixelLayout layout): _width(width),
+    _height(height), _layout(layout) {
+  allocPixels();
 }
 
 Image::Image(const Image& orig) {
@@ -53,11 +532,33 @@ Image::Image(const Image& orig) {
   _width = orig._width;
   _height = orig._height;
   _components = orig._components;
-  _pixels = new struct Pixel[_width * _height];
-  memcpy(_pixels, orig._pixels, sizeof(struct Pixel) * _width * _height);
+  _layout = orig._layout;
+  allocPixels();
+  memcpy(_pixels, orig._pixels, byteSize());
 }
 
 Image& Image::operator=(const Image& orig) {
+  if (&orig == this) {
+    return *this;
+  }
+  // keeps the buffer when it already has orig's size and layout
+  reshape(orig._width, orig._height, orig._layout);
+  _components = orig._components;
+  memcpy(_pixels, orig._pixels, byteSize());
+  return *this;
+}
+
+Image::Image(Image&& orig) noexcept: _width(orig._width),
+    _height(orig._height), _components(orig._components),
+    _layout(orig._layout), _pixels(orig._pixels) {
+  // take over the buffer, leaving orig empty
+  orig._pixels = NULL;
+  orig._width = 0;
+  orig._height = 0;
+  orig._components = 0;
+}
+
+Image& Image::operator=(Image&& orig) noexcept {
   if (&orig == this) {
     return *this;
   }
@@ -65,8 +566,12 @@ Image& Image::operator=(const Image& orig) {
   _width = orig._width;
   _height = orig._height;
   _components = orig._components;
-  _pixels = new struct Pixel[_width * _height];
-  memcpy(_pixels, orig._pixels, sizeof(struct Pixel) * _width * _height);
+  _layout = orig._layout;
+  _pixels = orig._pixels;
+  orig._pixels = NULL;
+  orig._width = 0;
+  orig._height = 0;
+  orig._components = 0;
   return *this;
 }
 
@@ -75,6 +580,109 @@ Image::~Image() {
   resetPixels();
 }
 
+// save w x h packed RGB pixels, with rows stride bytes apart, to filename
+static bool saveRows(const std::string& filename, ImageFormat format,
+    const unsigned char* rows, int w, int h, int64_t stride, bool flip) {
+  if (format == FORMAT_AUTO) {
+    format = formatFromName(filename);
+  }
+  if (flip) {
+    // start at the last row and step backwards (instead of stb's global
+    // flip setting, so saves on several threads don't interfere)
+    rows += stride * (h - 1);
+    stride = -stride;
+  }
+  if (format == FORMAT_PNG) {
+    return stbi_write_png(filename.c_str(), w, h, 3, rows, stride) != 0;
+  }
+  if (format == FORMAT_QOI) {
+    std::vector<unsigned char> qoi = encodeQoi(rows, w, h, stride);
+    return writeRows(filename, "", qoi.data(), qoi.size(), 1, qoi.size());
+  }
+  // raw and .ppm are the rows themselves, written without a copy
+  std::string header = (format == FORMAT_PPM) ? ppmHeader(w, h) : "";
+  return writeRows(filename, header, rows, sizeof(struct Pixel) * w, h,
+      stride);
+}
+
+Image::Image(const ImageView& view) {
+  reshape(view.width(), view.height(), PACKED_RGB);
+  _components = 3;
+  copyRows(view, 0, 0, _height);
+}
+
+ImageView::ImageView() {  }
+
+ImageView::ImageView(const unsigned char* data, int width, int height,
+    int64_t stride): _data(data), _width(width), _height(height),
+    _stride(stride) {
+  if (data == NULL || width <= 0 || height <= 0) {
+    *this = ImageView();
+  }
+}
+
+int ImageView::width() const {
+  return _width;
+}
+
+int ImageView::height() const {
+  return _height;
+}
+
+int64_t ImageView::stride() const {
+  return _stride;
+}
+
+const unsigned char* ImageView::data() const {
+  return _data;
+}
+
+const unsigned char* ImageView::row(int row) const {
+  return _data + row * _stride;
+}
+
+bool ImageView::empty() const {
+  return _data == NULL;
+}
+
+Pixel ImageView::get(int row, int col) const {
+  return ((const struct Pixel*) (_data + row * _stride))[col];
+}
+
+ImageView ImageView::view(int x, int y, int w, int h) const {
+  int x0 = std::max(x, 0);
+  int y0 = std::max(y, 0);
+  int x1 = std::min(x + w, _width);
+  int y1 = std::min(y + h, _height);
+  if (x0 >= x1 || y0 >= y1) {
+    return ImageView();
+  }
+  // same rows, starting further in
+  return ImageView(row(y0) + sizeof(struct Pixel) * x0, x1 - x0, y1 - y0,
+      _stride);
+}
+
+bool ImageView::save(const std::string& filename, bool flip) const {
+  if (empty()) {
+    return false;
+  }
+  return saveRows(filename, FORMAT_AUTO, _data, _width, _height, _stride,
+      flip);
+}
+
+ImageView Image::view() const {
+  return view(0, 0, _width, _height);
+}
+
+ImageView Image::view(int x, int y, int w, int h) const {
+  if (_layout != PACKED_RGB) {
+    std::cout << "Error: only packed RGB images can be viewed" << std::endl;
+    return ImageView();
+  }
+  return ImageView(_pixels, _width, _height,
+      sizeof(struct Pixel) * _width).view(x, y, w, h);
+}
+
 int Image::width() const {
   return _width;
 }
@@ -87,67 +695,390 @@ char* Image::data() const {
   return (char *) _pixels;
 }
 
+PixelLayout Image::layout() const {
+  return _layout;
+}
+
+Image Image::convert(PixelLayout layout) const {
+  Image result(_width, _height, layout);
+  result._components = _components;
+  if (layout == _layout) {
+    memcpy(result._pixels, _pixels, byteSize());
+    return result;
+  }
+  int64_t count = (int64_t) _width * _height;
+  for (int64_t i = 0; i < count; i++) {
+    result.set(i, get(i));
+  }
+  return result;
+}
+
 void Image::set(int width, int height, unsigned char* data) {
   resetPixels();
   _width = width;
   _height = height;
-  _pixels = new struct Pixel[_width * _height];
-  memcpy(_pixels, data, sizeof(struct Pixel) * _width * _height);
+  allocPixels();
+  if (_layout == PACKED_RGB) {
+    memcpy(_pixels, data, sizeof(struct Pixel) * _width * _height);
+    return;
+  }
+  const struct Pixel* src = (const struct Pixel*) data;
+  for (int64_t i = 0; i < (int64_t) _width * _height; i++) {
+    set(i, src[i]);
+  }
 }
 
 bool Image::load(const std::string& filename, bool flip) {
+  ImageFormat format = formatFromName(filename);
+  if (format == FORMAT_RAW) {
+    std::cout << "Error: " << filename << " has no size, use loadRaw"
+        << std::endl;
+    return false;
+  }
+  if ((format == FORMAT_PPM || format == FORMAT_QOI) &&
+      loadFormat(filename, format, flip)) {
+    return true;
+  }
+  if (format == FORMAT_QOI) {
+    // stb can't read .qoi
+    return false;
+  }
+  // other files, and .ppm files that aren't 8-bit P6, go through stb
   // if flip = true, will set stbi's flip variable to true also
   // auto conversion to bool (false = 0, true = 1)
   stbi_set_flip_vertically_on_load(flip);
-  // free pixel memory first
-  resetPixels();
-  // stbi_load returns unsigned char *, so must cast to struct Pixel *
+  // stbi_load returns packed RGB data, which is copied into our own aligned
+  // buffer so that the vector loops see the same alignment as everywhere else
   // also must convert filename from string to char *
   // requesting only 3 channels (RGB)
-  _pixels = (struct Pixel *) stbi_load(filename.c_str(), &_width, &_height,
-      &_components, 3);
-  _use_stbi_free = true;
-  if (_pixels == NULL) {
-    // allocation failure
+  int width;
+  int height;
+  int components;
+  unsigned char* data = stbi_load(filename.c_str(), &width, &height,
+      &components, 3);
+  if (data == NULL) {
+    // allocation failure, leave the image empty
+    resetPixels();
     return false;
-  } else {
-    // successful load
+  }
+  reshape(width, height, PACKED_RGB);
+  _components = components;
+  memcpy(_pixels, data, byteSize());
+  stbi_image_free(data);
+  return true;
+}
+
+bool Image::loadFormat(const std::string& filename, ImageFormat format,
+    bool flip) {
+  MappedFile file(filename);
+  ImageView pixels;
+  int width;
+  int height;
+  if (format == FORMAT_PPM) {
+    pixels = file.ppmView();
+    if (pixels.empty()) {
+      return false;
+    }
+    width = pixels.width();
+    height = pixels.height();
+  } else if (!qoiSize(file.data(), file.size(), width, height)) {
+    return false;
+  }
+  reshape(width, height, PACKED_RGB);
+  _components = 3;
+  if (format == FORMAT_QOI) {
+    int64_t rowBytes = sizeof(struct Pixel) * _width;
+    // a flipped load fills the rows from the bottom up
+    if (!decodeQoi(file.data(), file.size(),
+        flip ? _pixels + rowBytes * (_height - 1) : _pixels,
+        flip ? -rowBytes : rowBytes)) {
+      resetPixels();
+      return false;
+    }
     return true;
   }
+  copyMapped(pixels, flip);
+  return true;
+}
+
+bool Image::loadRaw(const std::string& filename, int width, int height,
+    bool flip) {
+  MappedFile file(filename);
+  ImageView pixels = file.rawView(width, height);
+  if (pixels.empty()) {
+    // missing, or smaller than width x height pixels
+    return false;
+  }
+  reshape(width, height, PACKED_RGB);
+  _components = 3;
+  copyMapped(pixels, flip);
+  return true;
+}
+
+void Image::copyMapped(const ImageView& pixels, bool flip) {
+  // one copy from the mapped file into the pixels, bottom up if flipped
+  for (int i = 0; i < _height; i++) {
+    unpackRow(flip ? _height - 1 - i : i, pixels.row(i));
+  }
+}
+
+bool Image::load(const std::string& filename, PixelLayout layout,
+    bool flip) {
+  if (!load(filename, flip)) {
+    return false;
+  }
+  if (layout != PACKED_RGB) {
+    // convert once here instead of in every filter
+    *this = convert(layout);
+  }
+  return true;
+}
+
+void Image::packRegion(unsigned char* dst, int x, int y, int w, int h) const {
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      struct Pixel p = get(y + i, x + j);
+      *dst++ = p.r;
+      *dst++ = p.g;
+      *dst++ = p.b;
+    }
+  }
 }
 
 bool Image::save(const std::string& filename, bool flip) const {
-  // if flip = true, will set stbi's flip variable to true also
-  stbi_flip_vertically_on_write(flip);
-  int result = stbi_write_png(filename.c_str(), _width, _height, 3,
-      _pixels, sizeof(struct Pixel) * _width);
-  if (result == 0) {
-    // failed to write file
+  return saveRegion(filename, FORMAT_AUTO, 0, 0, _width, _height, flip);
+}
+
+bool Image::save(const std::string& filename, ImageFormat format,
+    bool flip) const {
+  return saveRegion(filename, format, 0, 0, _width, _height, flip);
+}
+
+bool Image::save(const std::string& filename, const PngOptions& options,
+    bool flip) const {
+  int64_t rowBytes = sizeof(struct Pixel) * _width;
+  const unsigned char* rows = _pixels;
+  std::vector<unsigned char> packed;
+  if (_layout != PACKED_RGB) {
+    packed.resize(rowBytes * _height);
+    packRegion(packed.data(), 0, 0, _width, _height);
+    rows = packed.data();
+  }
+  if (flip) {
+    // start at the last row and step backwards
+    return writePng(filename, rows + rowBytes * (_height - 1), _width,
+        _height, -rowBytes, options);
+  }
+  return writePng(filename, rows, _width, _height, rowBytes, options);
+}
+
+bool Image::save(const std::string& filename, int x, int y, int w, int h,
+    bool flip) const {
+  if (x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > _width ||
+      y + h > _height) {
+    // region must lie inside the image
     return false;
-  } else {
-    // successful write
-    return true;
   }
+  return saveRegion(filename, FORMAT_AUTO, x, y, w, h, flip);
+}
+
+bool Image::saveRegion(const std::string& filename, ImageFormat format,
+    int x, int y, int w, int h, bool flip) const {
+  int64_t rowBytes = sizeof(struct Pixel) * w;
+  // point at the region's first pixel and step by full image rows, or
+  // pack the region first if the pixels aren't packed RGB
+  const unsigned char* rows =
+      _pixels + sizeof(struct Pixel) * ((int64_t) y * _width + x);
+  int64_t stride = sizeof(struct Pixel) * _width;
+  std::vector<unsigned char> packed;
+  if (_layout != PACKED_RGB) {
+    packed.resize(rowBytes * h);
+    packRegion(packed.data(), x, y, w, h);
+    rows = packed.data();
+    stride = rowBytes;
+  }
+  return saveRows(filename, format, rows, w, h, stride, flip);
 }
 
 Pixel Image::get(int row, int col) const {
-  return _pixels[row * _width + col];
+  return get((int64_t) row * _width + col);
 }
 
 void Image::set(int row, int col, const Pixel& color) {
-  _pixels[row * _width + col] = color;
+  set((int64_t) row * _width + col, color);
+}
+
+Pixel Image::get(int64_t i) const {
+  if (_layout == PACKED_RGB) {
+    return ((const struct Pixel*) _pixels)[i];
+  } else if (_layout == RGBA8) {
+    const unsigned char* p = _pixels + i * 4;
+    return Pixel{p[0], p[1], p[2]};
+  }
+  int64_t plane = planeStride(_width, _height);
+  return Pixel{_pixels[i], _pixels[plane + i], _pixels[plane * 2 + i]};
+}
+
+void Image::set(int64_t i, const Pixel& c) {
+  if (_layout == PACKED_RGB) {
+    ((struct Pixel*) _pixels)[i] = c;
+  } else if (_layout == RGBA8) {
+    unsigned char* p = _pixels + i * 4;
+    p[0] = c.r;
+    p[1] = c.g;
+    p[2] = c.b;
+    p[3] = 255;  // pad byte, unused
+  } else {
+    int64_t plane = planeStride(_width, _height);
+    _pixels[i] = c.r;
+    _pixels[plane + i] = c.g;
+    _pixels[plane * 2 + i] = c.b;
+  }
+}
+
+const unsigned char* Image::packedRow(int row,
+    std::vector<unsigned char>& buffer) const {
+  if (_layout == PACKED_RGB) {
+    return _pixels + sizeof(struct Pixel) * row * _width;
+  }
+  buffer.resize(sizeof(struct Pixel) * _width);
+  packRegion(buffer.data(), 0, row, _width, 1);
+  return buffer.data();
+}
+
+void Image::unpackRow(int row, const unsigned char* packed) {
+  if (_layout == PACKED_RGB) {
+    memcpy(_pixels + sizeof(struct Pixel) * row * _width, packed,
+        sizeof(struct Pixel) * _width);
+    return;
+  }
+  const struct Pixel* src = (const struct Pixel*) packed;
+  for (int j = 0; j < _width; j++) {
+    set(row, j, src[j]);
+  }
+}
+
+void Image::copyRows(const Image& src, int srcRow, int dstRow, int rows) {
+  if (src._layout != _layout) {
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < _width; j++) {
+        set(dstRow + i, j, src.get(srcRow + i, j));
+      }
+    }
+  } else if (_layout == PLANAR) {
+    int64_t srcPlane = planeStride(src._width, src._height);
+    int64_t dstPlane = planeStride(_width, _height);
+    for (int c = 0; c < 3; c++) {
+      memcpy(_pixels + dstPlane * c + (int64_t) dstRow * _width,
+          src._pixels + srcPlane * c + (int64_t) srcRow * _width,
+          (int64_t) rows * _width);
+    }
+  } else {
+    // rows are contiguous in the interleaved layouts
+    int64_t rowBytes = (int64_t) _width * bytesPerPixel(_layout);
+    memcpy(_pixels + dstRow * rowBytes, src._pixels + srcRow * rowBytes,
+        rows * rowBytes);
+  }
+}
+
+void Image::copyRows(const ImageView& src, int srcRow, int dstRow,
+    int rows) {
+  for (int i = 0; i < rows; i++) {
+    unpackRow(dstRow + i, src.row(srcRow + i));
+  }
+}
+
+void Image::fillRange(int64_t start, int64_t count, const Pixel& c) {
+  if (count <= 0) {
+    return;
+  }
+  if (_layout == PACKED_RGB) {
+    fillPixels((struct Pixel*) _pixels + start, count, c);
+  } else if (_layout == RGBA8) {
+    // each pixel is one 32-bit word
+    unsigned char bytes[4] = {c.r, c.g, c.b, 255};
+    uint32_t word;
+    memcpy(&word, bytes, 4);
+    std::fill_n((uint32_t*) _pixels + start, count, word);
+  } else {
+    int64_t plane = planeStride(_width, _height);
+    memset(_pixels + start, c.r, count);
+    memset(_pixels + plane + start, c.g, count);
+    memset(_pixels + plane * 2 + start, c.b, count);
+  }
+}
+
+void Image::blendRange(int64_t start, int64_t count, const Pixel& c,
+    int alpha) {
+  if (count <= 0 || alpha <= 0) {
+    return;
+  }
+  if (alpha >= 255) {
+    fillRange(start, count, c);
+    return;
+  }
+  // blend against a run of the color laid out like the pixels, 16 pixels
+  // at a time, so byte k of the run lines up with byte k of the image
+  const int run = 16;
+  unsigned char pattern[run * 4];
+  unsigned char channels[4] = {c.r, c.g, c.b, 255};
+  if (_layout == PLANAR) {
+    int64_t plane = planeStride(_width, _height);
+    for (int k = 0; k < 3; k++) {
+      memset(pattern, channels[k], run);
+      unsigned char* dst = _pixels + plane * k + start;
+      for (int64_t i = 0; i < count; i += run) {
+        int64_t n = std::min((int64_t) run, count - i);
+        blendModeBytes<BLEND_ALPHA>(dst + i, pattern, dst + i, n, alpha);
+      }
+    }
+    return;
+  }
+  int bytes = bytesPerPixel(_layout);
+  for (int i = 0; i < run * bytes; i++) {
+    pattern[i] = channels[i % bytes];
+  }
+  unsigned char* dst = _pixels + start * bytes;
+  for (int64_t i = 0; i < count; i += run) {
+    int64_t n = std::min((int64_t) run, count - i) * bytes;
+    blendModeBytes<BLEND_ALPHA>(dst + i * bytes, pattern, dst + i * bytes, n,
+        alpha);
+  }
+}
+
+void Image::fill(const Pixel& color) {
+  fillRange(0, (int64_t) _width * _height, color);
+}
+
+void Image::fillSpan(int row, int x0, int x1, const Pixel& color) {
+  fillRange((int64_t) row * _width + x0, x1 - x0 + 1, color);
 }
 
-Pixel Image::get(int i) const {
-  return _pixels[i];
+void Image::blendSpan(int row, int x0, int x1, const Pixel& color,
+    int alpha) {
+  blendRange((int64_t) row * _width + x0, x1 - x0 + 1, color, alpha);
 }
 
-void Image::set(int i, const Pixel& c) {
-  _pixels[i] = c;
+void Image::fillRect(int x, int y, int w, int h, const Pixel& color) {
+  int x0 = std::max(x, 0);
+  int y0 = std::max(y, 0);
+  int x1 = std::min(x + w, _width) - 1;
+  int y1 = std::min(y + h, _height) - 1;
+  if (x0 > x1 || y0 > y1) {
+    return;
+  }
+  if (x0 == 0 && x1 == _width - 1) {
+    // full rows are contiguous, fill them in one go
+    fillRange((int64_t) y0 * _width, (int64_t) (y1 - y0 + 1) * _width, color);
+    return;
+  }
+  for (int i = y0; i <= y1; i++) {
+    fillSpan(i, x0, x1, color);
+  }
 }
 
 Image Image::resize(int w, int h) const {
-  Image result(w, h);
+  Image result(w, h, _layout);
   for (int i = 0; i < h; i++) {
     float row_ratio = (float) i / (h - 1);
     int orig_row = floor(row_ratio * (_height - 1));
@@ -163,7 +1094,7 @@ Image Image::resize(int w, int h) const {
 }
 
 Image Image::flipHorizontal() const {
-  Image result(_width, _height);
+  Image result(_width, _height, _layout);
   for (int i = 0; i < _height; i++) {
     for (int j = 0; j < _width; j++) {
       // set new pixel to old pixel in mirrored half, folded horizontally
@@ -174,7 +1105,7 @@ Image Image::flipHorizontal() const {
 }
 
 Image Image::flipVertical() const {
-  Image result(_width, _height);
+  Image result(_width, _height, _layout);
   for (int i = 0; i < _height; i++) {
     for (int j = 0; j < _width; j++) {
       // set new pixel to old pixel in mirrored half, folded vertically
@@ -185,7 +1116,12 @@ Image Image::flipVertical() const {
 }
 
 Image Image::subimage(int startx, int starty, int w, int h) const {
-  Image sub(w, h);
+  if (_layout == PACKED_RGB && startx >= 0 && starty >= 0 &&
+      startx + w <= _width && starty + h <= _height) {
+    // one copy per row from a view of the region
+    return Image(view(startx, starty, w, h));
+  }
+  Image sub(w, h, _layout);
   for (int i = 0; i < h; i++) {
     for (int j = 0; j < w; j++) {
       sub.set(i, j, get(starty + i, startx + j));
@@ -205,21 +1141,116 @@ void Image::replace(const Image& image, int startx, int starty) {
   }
 }
 
-Image Image::gammaCorrect(float gamma) const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel pixel = get(i, j);  // copy original pixel
-      // RGB values must be converted to float in range [0, 1.0] first
-      pixel.r = round(pow((pixel.r / 255.0f), 1.0f / gamma) * 255.0f);
-      pixel.g = round(pow((pixel.g / 255.0f), 1.0f / gamma) * 255.0f);
-      pixel.b = round(pow((pixel.b / 255.0f), 1.0f / gamma) * 255.0f);
-      result.set(i, j, pixel);
+void Image::replace(const ImageView& view, int startx, int starty) {
+  // only the part of the view that lands on this image
+  ImageView part = view.view(-startx, -starty, _width, _height);
+  if (part.empty()) {
+    return;
+  }
+  int x = std::max(startx, 0);
+  int y = std::max(starty, 0);
+  for (int i = 0; i < part.height(); i++) {
+    const struct Pixel* row = (const struct Pixel*) part.row(i);
+    if (_layout == PACKED_RGB) {
+      memcpy(_pixels + sizeof(struct Pixel) * ((int64_t) (y + i) * _width + x),
+          row, sizeof(struct Pixel) * part.width());
+    } else {
+      for (int j = 0; j < part.width(); j++) {
+        set(y + i, x + j, row[j]);
+      }
     }
   }
+}
+
+Image Image::applyLUT(const uint8_t lut[3][256]) const {
+  Image result(_width, _height, _layout);
+  applyLUTInto(lut, result);
   return result;
 }
 
+void Image::applyLUTInto(const uint8_t lut[3][256], Image& dst) const {
+  dst.reshape(_width, _height, _layout);
+  int64_t count = (int64_t) _width * _height;
+  if (_layout == PLANAR) {
+    // one table per plane
+    int64_t plane = planeStride(_width, _height);
+    for (int c = 0; c < 3; c++) {
+      lookupBytes(lut[c], _pixels + plane * c, dst._pixels + plane * c,
+          count);
+    }
+    return;
+  }
+  if (memcmp(lut[0], lut[1], 256) == 0 && memcmp(lut[0], lut[2], 256) == 0) {
+    // the same table for every channel (gamma, brightness, invert, ...), so
+    // the channels need not be told apart; RGBA8 pad bytes go through too
+    lookupBytes(lut[0], _pixels, dst._pixels, byteSize());
+    return;
+  }
+  // interleaved channels with their own tables; the shuffles can't pick a
+  // table per byte, so this stays scalar
+  int step = bytesPerPixel(_layout);
+  const unsigned char* src = _pixels;
+  unsigned char* out = dst._pixels;
+  for (int64_t i = 0; i < count; i++, src += step, out += step) {
+    out[0] = lut[0][src[0]];
+    out[1] = lut[1][src[1]];
+    out[2] = lut[2][src[2]];
+  }
+}
+
+void Image::applyLUTInPlace(const uint8_t lut[3][256]) {
+  applyLUTInto(lut, *this);
+}
+
+void Image::gammaLUT(float gamma, uint8_t lut[3][256]) {
+  // tables are cached by gamma value, since a frame sequence usually
+  // corrects every frame with the same gamma
+  static std::mutex lock;
+  static std::map<float, std::vector<uint8_t>> cache;
+  std::lock_guard<std::mutex> guard(lock);
+  auto found = cache.find(gamma);
+  if (found == cache.end()) {
+    if (cache.size() >= 64) {
+      cache.clear();  // keep the cache small
+    }
+    std::vector<uint8_t> table(256);
+    for (int i = 0; i < 256; i++) {
+      unsigned char v = i;
+      // RGB values must be converted to float in range [0, 1.0] first
+      table[i] = round(pow((v / 255.0f), 1.0f / gamma) * 255.0f);
+    }
+    found = cache.emplace(gamma, table).first;
+  }
+  for (int c = 0; c < 3; c++) {
+    memcpy(lut[c], found->second.data(), 256);
+  }
+}
+
+Image Image::gammaCorrect(float gamma) const {
+  uint8_t lut[3][256];
+  gammaLUT(gamma, lut);
+  return applyLUT(lut);
+}
+
+Image Image::brightness(int delta) const {
+  uint8_t lut[3][256];
+  for (int v = 0; v < 256; v++) {
+    // shift every channel, clamp to [0, 255]
+    lut[0][v] = lut[1][v] = lut[2][v] = std::min(std::max(v + delta, 0), 255);
+  }
+  return applyLUT(lut);
+}
+
+Image Image::contrast(float factor) const {
+  uint8_t lut[3][256];
+  for (int v = 0; v < 256; v++) {
+    // stretch every channel away from (or toward) mid gray, clamp to [0, 255]
+    int stretched = round((v - 128) * factor + 128);
+    lut[0][v] = lut[1][v] = lut[2][v] = std::min(std::max(stretched, 0), 255);
+  }
+  return applyLUT(lut);
+}
+
 Pixel Image::alphaBlendPixel(const struct Pixel& orig,
     const struct Pixel& other, float alpha) const {
   struct Pixel corrected;
@@ -230,32 +1261,153 @@ Pixel Image::alphaBlendPixel(const struct Pixel& orig,
 }
 
 Image Image::alphaBlend(const Image& other, float alpha) const {
-  Image result(_width, _height);
+  Image result(_width, _height, _layout);
+  alphaBlendInto(other, alpha, result);
+  return result;
+}
+
+void Image::alphaBlendInto(const Image& other, float alpha, Image& dst) const {
+  dst.reshape(_width, _height, _layout);
+  if (other._layout == _layout && other._width == _width &&
+      other._height == _height) {
+    blendBytes(_pixels, other._pixels, dst._pixels, byteSize(), alpha);
+    return;
+  }
   for (int i = 0; i < _height; i++) {
     for (int j = 0; j < _width; j++) {
       struct Pixel blend = alphaBlendPixel(get(i, j), other.get(i, j), alpha);
-      result.set(i, j, blend);
+      dst.set(i, j, blend);
     }
   }
+}
+
+void Image::alphaBlendInPlace(const Image& other, float alpha) {
+  alphaBlendInto(other, alpha, *this);
+}
+
+Image Image::alphaBlend(const ImageView& other, float alpha) const {
+  Image result(_width, _height, _layout);
+  alphaBlendInto(other, alpha, result);
   return result;
 }
 
-Image Image::grayscale() const {
-  Image result(_width, _height);
+void Image::alphaBlendInto(const ImageView& other, float alpha,
+    Image& dst) const {
+  dst.reshape(_width, _height, _layout);
+  if (other.width() != _width || other.height() != _height) {
+    std::cout << "Error: alphaBlend needs a view of the same size" << std::endl;
+    return;
+  }
+  int64_t rowBytes = sizeof(struct Pixel) * _width;
   for (int i = 0; i < _height; i++) {
+    if (_layout == PACKED_RGB) {
+      // a row at a time, since the view's rows may not be contiguous
+      blendBytes(_pixels + i * rowBytes, other.row(i),
+          dst._pixels + i * rowBytes, rowBytes, alpha);
+      continue;
+    }
     for (int j = 0; j < _width; j++) {
-      struct Pixel orig = get(i,j);
-      unsigned char intensity = round((orig.r * 0.3) + (orig.g * 0.59) +
-          (orig.b * 0.11));  // weighted average
-      struct Pixel corrected = {intensity, intensity, intensity};
-      result.set(i, j, corrected);
+      dst.set(i, j, alphaBlendPixel(get(i, j), other.get(i, j), alpha));
     }
   }
+}
+
+void Image::alphaBlendInPlace(const ImageView& other, float alpha) {
+  alphaBlendInto(other, alpha, *this);
+}
+
+Image Image::grayscale() const {
+  Image result(_width, _height, _layout);
+  grayscaleInto(result);
   return result;
 }
 
+void Image::grayscaleInto(Image& dst) const {
+  dst.reshape(_width, _height, _layout);
+  int64_t count = (int64_t) _width * _height;
+  int64_t i = 0;
+#ifdef AGL_SSE2
+  // 8 pixels at a time in 16-bit lanes; the rare groups with a tie fall
+  // through to the scalar loop
+  __m128i zero = _mm_setzero_si128();
+  bool ties;
+  if (_layout == RGBA8) {
+    for (; i + 8 <= count; i += 8) {
+      const __m128i* p = (const __m128i*) (_pixels + i * 4);
+      __m128i gray = graySums(_mm_packs_epi32(
+          graySumRGBA(_mm_loadu_si128(p)),
+          graySumRGBA(_mm_loadu_si128(p + 1))), ties);
+      if (ties) {
+        grayscaleRange(dst, i, 8);
+        continue;
+      }
+      // copy the intensity into r, g and b, and set the pad byte
+      __m128i lo = _mm_unpacklo_epi16(gray, gray);
+      __m128i hi = _mm_unpackhi_epi16(gray, gray);
+      __m128i pad = _mm_set1_epi32(0xFF000000);
+      __m128i* q = (__m128i*) (dst._pixels + i * 4);
+      _mm_storeu_si128(q, _mm_or_si128(pad,
+          _mm_or_si128(lo, _mm_slli_epi32(lo, 8))));
+      _mm_storeu_si128(q + 1, _mm_or_si128(pad,
+          _mm_or_si128(hi, _mm_slli_epi32(hi, 8))));
+    }
+  } else if (_layout == PLANAR) {
+    int64_t plane = planeStride(_width, _height);
+    for (; i + 8 <= count; i += 8) {
+      __m128i lanes[3];
+      for (int c = 0; c < 3; c++) {
+        lanes[c] = _mm_unpacklo_epi8(_mm_loadl_epi64(
+            (const __m128i*) (_pixels + plane * c + i)), zero);
+      }
+      __m128i gray = graySums(graySum(lanes[0], lanes[1], lanes[2]), ties);
+      if (ties) {
+        grayscaleRange(dst, i, 8);
+        continue;
+      }
+      gray = _mm_packus_epi16(gray, zero);
+      for (int c = 0; c < 3; c++) {
+        _mm_storel_epi64((__m128i*) (dst._pixels + plane * c + i), gray);
+      }
+    }
+  } else {
+    // packed RGB: gather the channels of 8 pixels into lanes
+    for (; i + 8 <= count; i += 8) {
+      const unsigned char* p = _pixels + i * 3;
+      __m128i gray = graySums(graySum(
+          _mm_setr_epi16(p[0], p[3], p[6], p[9], p[12], p[15], p[18], p[21]),
+          _mm_setr_epi16(p[1], p[4], p[7], p[10], p[13], p[16], p[19], p[22]),
+          _mm_setr_epi16(p[2], p[5], p[8], p[11], p[14], p[17], p[20], p[23])),
+          ties);
+      if (ties) {
+        grayscaleRange(dst, i, 8);
+        continue;
+      }
+      short out[8];
+      _mm_storeu_si128((__m128i*) out, gray);
+      unsigned char* q = dst._pixels + i * 3;
+      for (int k = 0; k < 8; k++) {
+        q[k * 3] = q[k * 3 + 1] = q[k * 3 + 2] = out[k];
+      }
+    }
+  }
+#endif
+  grayscaleRange(dst, i, count - i);
+}
+
+void Image::grayscaleRange(Image& dst, int64_t start, int64_t count) const {
+  for (int64_t i = start; i < start + count; i++) {
+    unsigned char intensity = grayValue(get(i));  // weighted average
+    struct Pixel corrected = {intensity, intensity, intensity};
+    dst.set(i, corrected);
+  }
+}
+
+void Image::grayscaleInPlace() {
+  grayscaleInto(*this);
+}
+
 Image Image::rotate90() const {
-  Image result(_height, _width);
+  Image result(_height, _width, _layout);
   // width and height are switched (b/c image is transposed)
   for (int i = 0; i < _width; i++) {
     for (int j = 0; j < _height; j++) {
@@ -265,325 +1417,734 @@ Image Image::rotate90() const {
   return result;
 }
 
-Image Image::add(const Image& other) const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel p1 = get(i,j);
-      struct Pixel p2 = other.get(i,j);
-      // add colors component-wise, clamp at 255
-      struct Pixel p3 = {(unsigned char) std::min(p1.r + p2.r, 255),
-          (unsigned char) std::min(p1.g + p2.g, 255),
-          (unsigned char) std::min(p1.b + p2.b, 255)};
-      result.set(i, j, p3);
-    }
-  }
+Image Image::blend(const Image& other, BlendMode mode, int alpha) const {
+  Image result(_width, _height, _layout);
+  blendInto(other, mode, result, alpha);
   return result;
 }
 
-Image Image::subtract(const Image& other) const {
-  Image result(_width, _height);
+void Image::blendInto(const Image& other, BlendMode mode, Image& dst,
+    int alpha) const {
+  alpha = std::min(std::max(alpha, 0), 255);
+  dst.reshape(_width, _height, _layout);
+  if (other._layout == _layout && other._width == _width &&
+      other._height == _height) {
+    blendModeBytes(_pixels, other._pixels, dst._pixels, byteSize(), mode,
+        alpha);
+    return;
+  }
   for (int i = 0; i < _height; i++) {
     for (int j = 0; j < _width; j++) {
       struct Pixel p1 = get(i,j);
       struct Pixel p2 = other.get(i,j);
-      // subtract colors component-wise, clamp at 0
-      struct Pixel p3 = {(unsigned char) std::max(p1.r - p2.r, 0),
-          (unsigned char) std::max(p1.g - p2.g, 0),
-          (unsigned char) std::max(p1.b - p2.b, 0)};
-      result.set(i, j, p3);
+      struct Pixel p3 = {blendChannel(p1.r, p2.r, mode, alpha),
+          blendChannel(p1.g, p2.g, mode, alpha),
+          blendChannel(p1.b, p2.b, mode, alpha)};
+      dst.set(i, j, p3);
     }
   }
+}
+
+void Image::blendInPlace(const Image& other, BlendMode mode, int alpha) {
+  blendInto(other, mode, *this, alpha);
+}
+
+Image Image::blend(const ImageView& other, BlendMode mode, int alpha) const {
+  Image result(_width, _height, _layout);
+  blendInto(other, mode, result, alpha);
   return result;
 }
 
-Image Image::multiply(const Image& other) const {
-  Image result(_width, _height);
+void Image::blendInto(const ImageView& other, BlendMode mode, Image& dst,
+    int alpha) const {
+  alpha = std::min(std::max(alpha, 0), 255);
+  dst.reshape(_width, _height, _layout);
+  if (other.width() != _width || other.height() != _height) {
+    std::cout << "Error: blend needs a view of the same size" << std::endl;
+    return;
+  }
+  int64_t rowBytes = sizeof(struct Pixel) * _width;
   for (int i = 0; i < _height; i++) {
+    if (_layout == PACKED_RGB) {
+      // a row at a time, since the view's rows may not be contiguous
+      blendModeBytes(_pixels + i * rowBytes, other.row(i),
+          dst._pixels + i * rowBytes, rowBytes, mode, alpha);
+      continue;
+    }
     for (int j = 0; j < _width; j++) {
-      struct Pixel p1 = get(i,j);
-      struct Pixel p2 = other.get(i,j);
-      // multiply colors component-wise, clamp at 255
-      struct Pixel p3 = {(unsigned char) std::min(p1.r * p2.r, 255),
-          (unsigned char) std::min(p1.g * p2.g, 255),
-          (unsigned char) std::min(p1.b * p2.b, 255)};
-      result.set(i, j, p3);
+      struct Pixel p1 = get(i, j);
+      struct Pixel p2 = other.get(i, j);
+      struct Pixel p3 = {blendChannel(p1.r, p2.r, mode, alpha),
+          blendChannel(p1.g, p2.g, mode, alpha),
+          blendChannel(p1.b, p2.b, mode, alpha)};
+      dst.set(i, j, p3);
     }
   }
-  return result;
+}
+
+void Image::blendInPlace(const ImageView& other, BlendMode mode, int alpha) {
+  blendInto(other, mode, *this, alpha);
+}
+
+Image Image::add(const Image& other) const {
+  return blend(other, BLEND_ADD);
+}
+
+void Image::addInto(const Image& other, Image& dst) const {
+  blendInto(other, BLEND_ADD, dst);
+}
+
+void Image::addInPlace(const Image& other) {
+  blendInto(other, BLEND_ADD, *this);
+}
+
+Image Image::subtract(const Image& other) const {
+  return blend(other, BLEND_SUBTRACT);
+}
+
+void Image::subtractInto(const Image& other, Image& dst) const {
+  blendInto(other, BLEND_SUBTRACT, dst);
+}
+
+void Image::subtractInPlace(const Image& other) {
+  blendInto(other, BLEND_SUBTRACT, *this);
+}
+
+Image Image::multiply(const Image& other) const {
+  return blend(other, BLEND_MULTIPLY);
 }
 
 Image Image::difference(const Image& other) const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel p1 = get(i,j);
-      struct Pixel p2 = other.get(i,j);
-      // subtract colors component-wise, use absolute value
-      struct Pixel p3 = {(unsigned char) std::abs(p1.r - p2.r),
-          (unsigned char) std::abs(p1.g - p2.g),
-          (unsigned char) std::abs(p1.b - p2.b)};
-      result.set(i, j, p3);
-    }
-  }
-  return result;
+  return blend(other, BLEND_DIFFERENCE);
 }
 
 Image Image::swirl() const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel orig = get(i,j);
-      // rotate channels
-      struct Pixel corrected = {orig.g, orig.b, orig.r};
-      result.set(i, j, corrected);
-    }
-  }
+  Image result(_width, _height, _layout);
+  swirlInto(result);
   return result;
 }
 
-Image Image::lightest(const Image& other) const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel p1 = get(i,j);
-      struct Pixel p2 = other.get(i,j);
-      // get lightest color
-      struct Pixel p3 = {(unsigned char) std::max(p1.r, p2.r),
-          (unsigned char) std::max(p1.g, p2.g),
-          (unsigned char) std::max(p1.b, p2.b)};
-      result.set(i, j, p3);
+void Image::swirlInto(Image& dst) const {
+  dst.reshape(_width, _height, _layout);
+  int64_t count = (int64_t) _width * _height;
+  if (_layout == PLANAR) {
+    // rotating the channels rotates the planes
+    int64_t plane = planeStride(_width, _height);
+    if (&dst == this) {
+      std::rotate(_pixels, _pixels + plane, _pixels + plane * 3);
+    } else {
+      memcpy(dst._pixels, _pixels + plane, plane * 2);
+      memcpy(dst._pixels + plane * 2, _pixels, plane);
     }
+    return;
   }
-  return result;
+  int64_t i = 0;
+  if (_layout == RGBA8) {
+#ifdef AGL_SSE2
+    // r, g, b, pad in each 32-bit lane becomes g, b, r, pad
+    __m128i gb = _mm_set1_epi32(0x0000FFFF);
+    __m128i r = _mm_set1_epi32(0x00FF0000);
+    __m128i pad = _mm_set1_epi32(0xFF000000);
+    for (; i + 4 <= count; i += 4) {
+      __m128i x = _mm_loadu_si128((const __m128i*) (_pixels + i * 4));
+      __m128i y = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 8), gb),
+          _mm_or_si128(_mm_and_si128(_mm_slli_epi32(x, 16), r),
+              _mm_and_si128(x, pad)));
+      _mm_storeu_si128((__m128i*) (dst._pixels + i * 4), y);
+    }
+#endif
+  }
+  int step = bytesPerPixel(_layout);
+  const unsigned char* src = _pixels + i * step;
+  unsigned char* out = dst._pixels + i * step;
+  for (; i < count; i++, src += step, out += step) {
+    // rotate channels
+    unsigned char orig = src[0];
+    out[0] = src[1];
+    out[1] = src[2];
+    out[2] = orig;
+  }
+}
+
+void Image::swirlInPlace() {
+  swirlInto(*this);
+}
+
+Image Image::lightest(const Image& other) const {
+  return blend(other, BLEND_LIGHTEST);
 }
 
 Image Image::darkest(const Image& other) const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel p1 = get(i,j);
-      struct Pixel p2 = other.get(i,j);
-      // get darkest color
-      struct Pixel p3 = {(unsigned char) std::min(p1.r, p2.r),
-          (unsigned char) std::min(p1.g, p2.g),
-          (unsigned char) std::min(p1.b, p2.b)};
-      result.set(i, j, p3);
-    }
+  return blend(other, BLEND_DARKEST);
+}
+
+Image Image::invert() const {
+  Image result(_width, _height, _layout);
+  invertInto(result);
+  return result;
+}
+
+void Image::invertInto(Image& dst) const {
+  // subtract colors from 255
+  uint8_t lut[3][256];
+  for (int v = 0; v < 256; v++) {
+    lut[0][v] = lut[1][v] = lut[2][v] = 255 - v;
   }
+  applyLUTInto(lut, dst);
+}
+
+void Image::invertInPlace() {
+  invertInto(*this);
+}
+
+Image Image::extractChannel(int channel) const {
+  Image result(_width, _height, _layout);
+  extractChannelInto(channel, result);
   return result;
 }
 
-Image Image::invert() const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel p = get(i,j);
-      // subtract colors from 255
-      p.r = 255 - p.r;
-      p.g = 255 - p.g;
-      p.b = 255 - p.b;
-      result.set(i, j, p);
+void Image::extractChannelInto(int channel, Image& dst) const {
+  if (channel < 1 || channel > 3) {
+    // no change if invalid channel
+    std::cout << "Invalid channel: " << channel << std::endl;
+    if (&dst != this) {
+      dst = *this;
     }
+    return;
   }
-  return result;
+  dst.reshape(_width, _height, _layout);
+  if (_layout == PLANAR) {
+    // only keep the specified plane, others set to zero
+    int64_t plane = planeStride(_width, _height);
+    for (int c = 0; c < 3; c++) {
+      if (c == channel - 1) {
+        memmove(dst._pixels + plane * c, _pixels + plane * c, plane);
+      } else {
+        memset(dst._pixels + plane * c, 0, plane);
+      }
+    }
+    return;
+  }
+  // only keep the specified channel (and the pad byte), others set to zero
+  int step = bytesPerPixel(_layout);
+  unsigned char mask[48];
+  for (int k = 0; k < 48; k++) {
+    mask[k] = k % step == channel - 1 || k % step == 3 ? 255 : 0;
+  }
+  maskBytes(_pixels, mask, dst._pixels, byteSize());
 }
 
-Image Image::extractChannel(int channel) const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel p = get(i,j);
-      // only keep the specified channel, others set to zero
-      if (channel == 1) {
-        p.g = 0;
-        p.b = 0;
-      } else if (channel == 2) {
-        p.r = 0;
-        p.b = 0;
-      } else if (channel == 3) {
-        p.r = 0;
-        p.g = 0;
+void Image::extractChannelInPlace(int channel) {
+  extractChannelInto(channel, *this);
+}
+
+// 3x3 kernels for Convolve. The weights are compile-time constants, so
+// after unrolling the zero weights vanish and the ones become plain adds
+
+// horizontal gradient, as used by the original sobelEdge
+struct SobelX {
+  static constexpr int weights[9] = {1, 0, -1, 2, 0, -2, 0, 0, -1};
+};
+constexpr int SobelX::weights[9];
+
+// vertical gradient
+struct SobelY {
+  static constexpr int weights[9] = {1, 2, 1, 0, 0, 0, -1, -2, -1};
+};
+constexpr int SobelY::weights[9];
+
+// sum of the neighborhood
+struct Box3 {
+  static constexpr int weights[9] = {1, 1, 1, 1, 1, 1, 1, 1, 1};
+};
+constexpr int Box3::weights[9];
+
+// one kernel tap per instantiation, so the taps are unrolled at compile
+// time. Tap adds row Tap / Size at column Tap % Size, where k is the byte of
+// the window's first column and columns are stride bytes apart (3 for
+// packed RGB, 1 for a single channel)
+template <int Size, typename Kernel, int Tap>
+struct ConvolveTaps {
+  static int add(const unsigned char* const* rows, int k, int stride) {
+    const int weight = Kernel::weights[Tap];
+    int rest = ConvolveTaps<Size, Kernel, Tap + 1>::add(rows, k, stride);
+    if (weight == 0) {
+      return rest;
+    }
+    return rest + rows[Tap / Size][k + (Tap % Size) * stride] * weight;
+  }
+
+#ifdef AGL_SSE2
+  // the same for 8 consecutive bytes at once, in 16-bit lanes
+  static __m128i add8(const unsigned char* const* rows, int k, int stride,
+      __m128i sum) {
+    const int weight = Kernel::weights[Tap];
+    if (weight != 0) {
+      const unsigned char* p = rows[Tap / Size] + k + (Tap % Size) * stride;
+      __m128i x = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) p),
+          _mm_setzero_si128());
+      if (weight == 1) {
+        sum = _mm_add_epi16(sum, x);
+      } else if (weight == -1) {
+        sum = _mm_sub_epi16(sum, x);
       } else {
-        // no change if invalid channel
-        std::cout << "Invalid channel: " << channel << std::endl;
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(x, _mm_set1_epi16(weight)));
       }
-      result.set(i, j, p);
     }
+    return ConvolveTaps<Size, Kernel, Tap + 1>::add8(rows, k, stride, sum);
   }
+#endif
+};
+
+template <int Size, typename Kernel>
+struct ConvolveTaps<Size, Kernel, Size * Size> {
+  static int add(const unsigned char* const*, int, int) {
+    return 0;
+  }
+
+#ifdef AGL_SSE2
+  static __m128i add8(const unsigned char* const*, int, int, __m128i sum) {
+    return sum;
+  }
+#endif
+};
+
+/**
+ * Convolve a Size x Size neighborhood with Kernel::weights. lane(),
+ * lanes8() and interior() need every neighbor inside the image and do no
+ * bounds checks; border() skips the neighbors that fall outside the image,
+ * the same as the original edge and corner cases
+ */
+template <int Size, typename Kernel>
+struct Convolve {
+  static const int radius = Size / 2;
+  typedef ConvolveTaps<Size, Kernel, 0> Taps;
+
+  // rows[m] is row i + m - radius; return the sum for byte k, whose
+  // horizontal neighbors are stride bytes away
+  static int lane(const unsigned char* const* rows, int k, int stride) {
+    return Taps::add(rows, k - radius * stride, stride);
+  }
+
+#ifdef AGL_SSE2
+  // sums for bytes k to k + 7 (each must fit in 16 bits)
+  static __m128i lanes8(const unsigned char* const* rows, int k, int stride) {
+    return Taps::add8(rows, k - radius * stride, stride, _mm_setzero_si128());
+  }
+#endif
+
+  // rows[m] is packed RGB row i + m - radius; add the sums for column j
+  static void interior(const unsigned char* const* rows, int j, int sum[3]) {
+    for (int c = 0; c < 3; c++) {
+      sum[c] += lane(rows, j * 3 + c, 3);
+    }
+  }
+
+  static void border(const Image& image, int i, int j, int sum[3]) {
+    for (int m = 0; m < Size; m++) {
+      int y = i + m - radius;
+      if (y < 0 || y >= image.height()) {
+        continue;
+      }
+      for (int n = 0; n < Size; n++) {
+        int x = j + n - radius;
+        const int weight = Kernel::weights[m * Size + n];
+        if (x < 0 || x >= image.width() || weight == 0) {
+          continue;
+        }
+        struct Pixel p = image.get(y, x);
+        sum[0] += p.r * weight;
+        sum[1] += p.g * weight;
+        sum[2] += p.b * weight;
+      }
+    }
+  }
+};
+
+Image Image::blur(int radius) const {
+  Image result(_width, _height, _layout);
+  blurInto(result, radius);
   return result;
 }
 
-int* Image::convolve(const int * matrix, int * result, int i, int j,
-    Position position) const {
-  int startRow, endRow, startCol, endCol;
-  if (position == MIDDLE) {
-    // a middle pixel, has 8 neighbors + itself
-    startRow = -1;
-    endRow = 1;
-    startCol = -1;
-    endCol = 1;
-  } else if (position == CORNER) {
-    if (i == 0 && j == 0) {
-      // top left pixel, has 3 neighbors + itself
-      startRow = 0;
-      endRow = 1;
-      startCol = 0;
-      endCol = 1;
-    } else if (i == 0 && j == _width - 1) {
-      // top right pixel, has 3 neighbors + itself
-      startRow = 0;
-      endRow = 1;
-      startCol = -1;
-      endCol = 0;
-    } else if (i == _height - 1 && j == 0) {
-      // bottom left pixel, has 3 neighbors + itself
-      startRow = -1;
-      endRow = 0;
-      startCol = 0;
-      endCol = 1;
-    } else {  // i == _height - 1 && j == _width - 1
-      // bottom right pixel, has 3 neighbors + itself
-      startRow = -1;
-      endRow = 0;
-      startCol = -1;
-      endCol = 0;
-    }
-  } else { //some type of edge pixel
-    if (i == 0) {
-      // top edge pixel, has 5 neighbors + itself
-      startRow = 0;
-      endRow = 1;
-      startCol = -1;
-      endCol = 1;
-    } else if (i == _height - 1) {
-      // bottom edge pixel, has 5 neighbors + itself
-      startRow = -1;
-      endRow = 0;
-      startCol = -1;
-      endCol = 1;
-    } else if (j == 0) {
-      // left edge pixel, has 5 neighbors + itself
-      startRow = -1;
-      endRow = 1;
-      startCol = 0;
-      endCol = 1;
-    } else { // j == _width - 1
-      // right edge pixel, has 5 neighbors + itself
-      startRow = -1;
-      endRow = 1;
-      startCol = -1;
-      endCol = 0;
-    }
-  }
-  for (int m = startRow; m <= endRow; m++) {
-    for (int n = startCol; n <= endCol; n++) {
-      struct Pixel p = get(i + m, j + n);
-      result[0] += p.r * matrix[((m + 1) * 3) + (n + 1)];
-      result[1] += p.g * matrix[((m + 1) * 3) + (n + 1)];
-      result[2] += p.b * matrix[((m + 1) * 3) + (n + 1)];
+// helper for blurRow: sum / denom rounded half up, in integers. round() on
+// the float quotient stops being exact once the sums pass 2^24 (radius 128)
+static int roundedDivide(int64_t sum, int64_t denom) {
+  return (sum + denom / 2) / denom;
+}
+
+// helper to write one output row of the box blur: slide a window of
+// 2 * radius + 1 columns along the column sums, where each column sum covers
+// `rows` image rows. The window is cut off at the image edges and the
+// average is taken over the pixels actually covered, e.g. 4, 6 or 9 pixels
+// for a radius of 1. Sums are 64-bit, as 255 times a window of more than
+// 8.4 MP no longer fits an int
+static void blurRow(const int64_t* colSum, unsigned char* out, int width,
+    int radius, int rows) {
+  int64_t sum[3] = {0, 0, 0};
+  for (int j = 0; j <= std::min(radius, width - 1); j++) {
+    for (int c = 0; c < 3; c++) {
+      sum[c] += colSum[j * 3 + c];
+    }
+  }
+  // column j averages columns [j - radius, j + radius], clamped to the row.
+  // Left border: nothing leaves the window yet
+  int left = std::min(radius, width);
+  int right = std::max(left, width - radius - 1);
+  int j = 0;
+  for (; j < left; j++) {
+    int64_t denom = (int64_t) rows * (std::min(j + radius, width - 1) + 1);
+    for (int c = 0; c < 3; c++) {
+      out[j * 3 + c] = roundedDivide(sum[c], denom);
+      if (j + radius + 1 < width) {
+        sum[c] += colSum[(j + radius + 1) * 3 + c];
+      }
+    }
+  }
+  // middle: the window is full width, one column in and one out. The
+  // divisor is fixed here, so divide by multiplying with a 48-bit
+  // reciprocal; that is exact for sums up to 255 * denom while
+  // denom < 2^20, as long as the product stays below 2^64
+  int64_t denom = (int64_t) rows * (2 * radius + 1);
+  int64_t half = denom / 2;
+  uint64_t recip = ((1ULL << 48) + denom - 1) / denom;
+  bool exact = denom < (1 << 20) &&
+      (uint64_t) (255 * denom + half) < UINT64_MAX / recip;
+  for (; j < right; j++) {
+    for (int c = 0; c < 3; c++) {
+      out[j * 3 + c] = exact ? ((uint64_t) (sum[c] + half) * recip) >> 48 :
+          roundedDivide(sum[c], denom);
+      sum[c] += colSum[(j + radius + 1) * 3 + c] - colSum[(j - radius) * 3 + c];
+    }
+  }
+  // right border: nothing enters the window any more
+  for (; j < width; j++) {
+    int64_t denom = (int64_t) rows * (width - (j - radius));
+    for (int c = 0; c < 3; c++) {
+      out[j * 3 + c] = roundedDivide(sum[c], denom);
+      sum[c] -= colSum[(j - radius) * 3 + c];
     }
   }
-  return result;
 }
 
-Image Image::blur() const {
-  Image result(_width, _height);
-  int matrix[9] = {1, 1, 1, 1, 1, 1, 1, 1, 1};
+void Image::blurInto(Image& dst, int radius) const {
+  if (&dst == this) {
+    // every output pixel reads its neighbors, so it can't overwrite them
+    std::cout << "Error: blurInto needs a different destination image"
+        << std::endl;
+    return;
+  }
+  if (radius < 0) {
+    std::cout << "Error: blur radius must be at least 0" << std::endl;
+    dst = *this;
+    return;
+  }
+  dst.reshape(_width, _height, _layout);
+  if (_width == 0 || _height == 0) {
+    return;
+  }
+  // a window past every edge already covers the whole image, so larger radii
+  // give the same output; clamping keeps i + radius from overflowing
+  radius = std::min(radius, std::max(_width, _height));
+  // separable running sums: colSum holds, per column and channel, the sum
+  // over the rows in the vertical window; each output row then slides a
+  // window across colSum. Both windows move by adding the entering line and
+  // subtracting the leaving one, so the cost per pixel does not depend on
+  // the radius
+  std::vector<int64_t> colSum(_width * 3, 0);
+  std::vector<unsigned char> in;
+  std::vector<unsigned char> out(_width * 3);
+  for (int i = 0; i <= std::min(radius, _height - 1); i++) {
+    const unsigned char* row = packedRow(i, in);
+    for (int k = 0; k < _width * 3; k++) {
+      colSum[k] += row[k];
+    }
+  }
   for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      int convolved[3] = {0, 0, 0};  // sum of convolved area, component-wise
-      int denom;  // denominator for averaging neighborhood
-      struct Pixel p = get(i,j);
-      if ((i > 0 && i < _height - 1) && (j > 0 && j < _width - 1)) {
-        convolve(matrix, convolved, i, j, MIDDLE);
-        denom = 9;  // middle pixels have 8 neighbors + itself
-      } else if ((i == 0 && j == 0) || (i == 0 && j == _width - 1) ||
-          (i == _height - 1 && j == 0) ||
-          (i == _height - 1 && j == _width - 1)) {
-        convolve(matrix, convolved, i, j, CORNER);
-        denom = 4;  // corner pixels have 3 neighbors + itself
-      } else {
-        convolve(matrix, convolved, i, j, EDGE);
-        denom = 6;  // edge pixels have 5 neighbors + itself
+    int rows = std::min(i + radius, _height - 1) - std::max(i - radius, 0) + 1;
+    blurRow(colSum.data(), out.data(), _width, radius, rows);
+    dst.unpackRow(i, out.data());
+    // slide the vertical window down one row
+    if (i + radius + 1 < _height) {
+      const unsigned char* row = packedRow(i + radius + 1, in);
+      for (int k = 0; k < _width * 3; k++) {
+        colSum[k] += row[k];
+      }
+    }
+    if (i - radius >= 0) {
+      const unsigned char* row = packedRow(i - radius, in);
+      for (int k = 0; k < _width * 3; k++) {
+        colSum[k] -= row[k];
       }
-      p.r = round((float) convolved[0] / denom);
-      p.g = round((float) convolved[1] / denom);
-      p.b = round((float) convolved[2] / denom);
-      result.set(i, j, p);
     }
   }
-  return result;
 }
 
 Image Image::extractWhite(int threshold) const {
-  Image result(_width, _height);
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel p = get(i,j);
-      if (p.r >= threshold && p.g >= threshold && p.b >= threshold) {
-        // meets threshold, set to white
-        p = {255, 255, 255};
-      } else {
-        // set to black
-        p = {0, 0, 0};
+  Image result(_width, _height, _layout);
+  extractWhiteInto(threshold, result);
+  return result;
+}
+
+void Image::extractWhiteInto(int threshold, Image& dst) const {
+  dst.reshape(_width, _height, _layout);
+  // each channel passes if it meets the threshold; the pixel becomes white
+  // only if all three pass, else black. Both steps happen in one pass
+  uint8_t pass[256];
+  for (int v = 0; v < 256; v++) {
+    pass[v] = v >= threshold ? 255 : 0;
+  }
+  int64_t count = (int64_t) _width * _height;
+  int64_t i = 0;
+#ifdef AGL_SSE2
+  // v >= t exactly where max(v, t) == v; past 255 nothing passes, which is
+  // left to the scalar loops
+  __m128i t = _mm_set1_epi8((char) std::min(std::max(threshold, 0), 255));
+  if (threshold <= 255 && _layout == PLANAR) {
+    int64_t plane = planeStride(_width, _height);
+    for (; i + 16 <= count; i += 16) {
+      __m128i white = _mm_set1_epi8((char) 0xFF);
+      for (int c = 0; c < 3; c++) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (_pixels + plane * c + i));
+        white = _mm_and_si128(white, _mm_cmpeq_epi8(_mm_max_epu8(v, t), v));
+      }
+      for (int c = 0; c < 3; c++) {
+        _mm_storeu_si128((__m128i*) (dst._pixels + plane * c + i), white);
       }
-      result.set(i, j, p);
+    }
+  } else if (threshold <= 255 && _layout == RGBA8) {
+    for (; i + 4 <= count; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*) (_pixels + i * 4));
+      __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, t), v);
+      // AND r, g and b into the low byte, then copy it into r, g and b and
+      // set the pad byte
+      __m128i white = _mm_and_si128(_mm_and_si128(m, _mm_srli_epi32(m, 8)),
+          _mm_and_si128(_mm_srli_epi32(m, 16), _mm_set1_epi32(0xFF)));
+      white = _mm_or_si128(_mm_or_si128(white, _mm_slli_epi32(white, 8)),
+          _mm_or_si128(_mm_slli_epi32(white, 16), _mm_set1_epi32(0xFF000000)));
+      _mm_storeu_si128((__m128i*) (dst._pixels + i * 4), white);
     }
   }
+#endif
+  if (_layout == PACKED_RGB) {
+    const unsigned char* src = _pixels + i * 3;
+    unsigned char* out = dst._pixels + i * 3;
+    for (; i < count; i++, src += 3, out += 3) {
+      out[0] = out[1] = out[2] = pass[src[0]] & pass[src[1]] & pass[src[2]];
+    }
+    return;
+  }
+  for (; i < count; i++) {
+    struct Pixel p = get(i);
+    unsigned char white = pass[p.r] & pass[p.g] & pass[p.b];
+    dst.set(i, Pixel{white, white, white});
+  }
+}
+
+void Image::extractWhiteInPlace(int threshold) {
+  extractWhiteInto(threshold, *this);
+}
+
+Image Image::glow(int threshold, int radius) const {
+  Image result;
+  Image whitened;
+  glowInto(result, whitened, threshold, radius);
   return result;
 }
 
-Image Image::glow(int threshold) const {
-  Image result(_width, _height);
-  Image whitened = extractWhite(threshold);
-  whitened = whitened.blur();
-  for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      struct Pixel whiteP = whitened.get(i, j);
-      float alpha = (whiteP.r + whiteP.g + whiteP.b) / (6 * 255.0f);
-      result.set(i, j, alphaBlendPixel(get(i, j), whiteP, alpha));
-    }
+void Image::glowInto(Image& dst, Image& whitened, int threshold,
+    int radius) const {
+  if (&dst == this || &whitened == this || &whitened == &dst) {
+    std::cout << "Error: glowInto needs three different images" << std::endl;
+    return;
   }
+  extractWhiteInto(threshold, whitened);
+  whitened.blurInto(dst, radius);
+  // same layout and size on all three, so bytes pair up one to one
+  glowBytes(_pixels, dst._pixels, dst._pixels, byteSize());
+}
+
+Image Image::sobelEdge(EdgeMagnitude magnitude) const {
+  Image result(_width, _height, _layout);
+  sobelEdgeInto(result, magnitude);
   return result;
 }
 
-Image Image::sobelEdge() const {
-  Image result(_width, _height);
-  int gx[9] = {1, 0, -1, 2, 0, -2, 0, 0, -1};
-  int gy[9] = {1, 2, 1, 0, 0, 0, -1, -2, -1};
+// helper to build the exact edge strength for every gx^2 + gy^2 up to
+// 255.5^2; past that the strength always clamps to 255
+static std::vector<unsigned char> sobelTable() {
+  std::vector<unsigned char> table(65281);
+  for (int m = 0; m < table.size(); m++) {
+    // same float rounding as sqrt(pow(gx, 2) + pow(gy, 2))
+    float distance = sqrt((double) m);
+    table[m] = std::min((int) round(distance), 255);
+  }
+  return table;
+}
+
+// helper to turn the gradients of one channel into an edge strength
+static unsigned char sobelMagnitude(int gx, int gy, EdgeMagnitude magnitude) {
+  if (magnitude == EDGE_L1) {
+    return std::min(std::abs(gx) + std::abs(gy), 255);
+  }
+  static const std::vector<unsigned char> table = sobelTable();
+  int m = gx * gx + gy * gy;
+  return m < table.size() ? table[m] : 255;
+}
+
+// helper to write the edge strengths of bytes [begin, end) of the middle
+// row of rows, whose horizontal neighbors are stride bytes apart
+static void sobelLanes(const unsigned char* const* rows, unsigned char* out,
+    int begin, int end, int stride, EdgeMagnitude magnitude) {
+  typedef Convolve<3, SobelX> Gx;
+  typedef Convolve<3, SobelY> Gy;
+  int k = begin;
+#ifdef AGL_SSE2
+  // |gx| <= 7 * 255 and |gy| <= 8 * 255 both fit in 16-bit lanes
+  for (; k + 8 <= end; k += 8) {
+    __m128i gx = Gx::lanes8(rows, k, stride);
+    __m128i gy = Gy::lanes8(rows, k, stride);
+    __m128i strength;
+    if (magnitude == EDGE_L1) {
+      __m128i zero = _mm_setzero_si128();
+      strength = _mm_adds_epi16(_mm_max_epi16(gx, _mm_sub_epi16(zero, gx)),
+          _mm_max_epi16(gy, _mm_sub_epi16(zero, gy)));
+    } else {
+      // gx^2 + gy^2 in 32 bits from interleaved (gx, gy) pairs; it stays
+      // below 2^24, so it is exact as a float, and the float square root
+      // rounds the same as the double one converted to float
+      __m128i lo = _mm_unpacklo_epi16(gx, gy);
+      __m128i hi = _mm_unpackhi_epi16(gx, gy);
+      __m128 m0 = _mm_cvtepi32_ps(_mm_madd_epi16(lo, lo));
+      __m128 m1 = _mm_cvtepi32_ps(_mm_madd_epi16(hi, hi));
+      strength = _mm_packs_epi32(roundLanes(_mm_sqrt_ps(m0)),
+          roundLanes(_mm_sqrt_ps(m1)));
+    }
+    // saturating pack clamps at 255
+    _mm_storel_epi64((__m128i*) (out + k),
+        _mm_packus_epi16(strength, strength));
+  }
+#endif
+  for (; k < end; k++) {
+    out[k] = sobelMagnitude(Gx::lane(rows, k, stride),
+        Gy::lane(rows, k, stride), magnitude);
+  }
+}
+
+bool Image::isGray() const {
+  int64_t count = (int64_t) _width * _height;
+  if (_layout == PACKED_RGB) {
+    int64_t bytes = count * 3;
+    int64_t i = 0;
+#ifdef AGL_SSE2
+    // compare every byte with the next one; the pairs that matter are
+    // (r, g) and (g, b), i.e. the bytes at k % 3 != 2. 48 bytes are three
+    // 16-byte chunks, and ignored marks the other pairs in each chunk
+    __m128i ignored[3];
+    for (int c = 0; c < 3; c++) {
+      unsigned char pattern[16];
+      for (int k = 0; k < 16; k++) {
+        pattern[k] = (c * 16 + k) % 3 == 2 ? 0xFF : 0;
+      }
+      ignored[c] = _mm_loadu_si128((const __m128i*) pattern);
+    }
+    for (; i + 49 <= bytes; i += 48) {
+      for (int c = 0; c < 3; c++) {
+        const unsigned char* p = _pixels + i + c * 16;
+        __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p),
+            _mm_loadu_si128((const __m128i*) (p + 1)));
+        if (_mm_movemask_epi8(_mm_or_si128(same, ignored[c])) != 0xFFFF) {
+          return false;
+        }
+      }
+    }
+#endif
+    for (; i < bytes; i += 3) {
+      if (_pixels[i] != _pixels[i + 1] || _pixels[i + 1] != _pixels[i + 2]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  for (int64_t i = 0; i < count; i++) {
+    struct Pixel p = get(i);
+    if (p.r != p.g || p.g != p.b) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Image::sobelEdgeInto(Image& dst, EdgeMagnitude magnitude) const {
+  if (&dst == this) {
+    std::cout << "Error: sobelEdgeInto needs a different destination image"
+        << std::endl;
+    return;
+  }
+  dst.reshape(_width, _height, _layout);
+  // a gray image has the same edges in every channel, so only one channel
+  // needs to be convolved
+  bool gray = isGray();
+  std::vector<unsigned char> buffers[3];
+  std::vector<unsigned char> channel[3];
+  std::vector<unsigned char> edges(_width);
+  std::vector<unsigned char> out(sizeof(struct Pixel) * _width);
+  auto borderPixel = [&](int i, int j) {
+    int gx[3] = {0, 0, 0};
+    int gy[3] = {0, 0, 0};
+    Convolve<3, SobelX>::border(*this, i, j, gx);
+    Convolve<3, SobelY>::border(*this, i, j, gy);
+    for (int c = 0; c < 3; c++) {
+      out[j * 3 + c] = sobelMagnitude(gx[c], gy[c], magnitude);
+    }
+  };
   for (int i = 0; i < _height; i++) {
-    for (int j = 0; j < _width; j++) {
-      int gxConv[3] = {0, 0, 0};  // sum of convolved area, component-wise
-      int gyConv[3] = {0, 0, 0};  // sum of convolved area, component-wise
-      struct Pixel p = get(i, j);
-      Position position;
-      if ((i > 0 && i < _height - 1) && (j > 0 && j < _width - 1)) {
-        position = MIDDLE;
-      } else if ((i == 0 && j == 0) || (i == 0 && j == _width - 1) ||
-          (i == _height - 1 && j == 0) ||
-          (i == _height - 1 && j == _width - 1)) {
-        position = CORNER;
-      } else {
-        position = EDGE;
+    if (i == 0 || i == _height - 1) {
+      for (int j = 0; j < _width; j++) {
+        borderPixel(i, j);
+      }
+      dst.unpackRow(i, out.data());
+      continue;
+    }
+    const unsigned char* rows[3];
+    for (int m = 0; m < 3; m++) {
+      int row = i + m - 1;
+      if (!gray) {
+        rows[m] = packedRow(row, buffers[m]);
+        continue;
+      }
+      // single channel rows are kept by row % 3, so each row is extracted
+      // once rather than for all three rows that read it
+      std::vector<unsigned char>& single = channel[row % 3];
+      if (m == 2 || i == 1) {
+        const unsigned char* packed = packedRow(row, buffers[m]);
+        single.resize(_width);
+        for (int j = 0; j < _width; j++) {
+          single[j] = packed[j * 3];
+        }
+      }
+      rows[m] = single.data();
+    }
+    // columns 1 to width - 2 have all their neighbors
+    if (gray) {
+      sobelLanes(rows, edges.data(), 1, _width - 1, 1, magnitude);
+      for (int j = 1; j < _width - 1; j++) {
+        out[j * 3] = out[j * 3 + 1] = out[j * 3 + 2] = edges[j];
       }
-      convolve(gx, gxConv, i, j, position);
-      convolve(gy, gyConv, i, j, position);
-      float distanceRed = sqrt(pow(gxConv[0], 2) + pow(gyConv[0], 2));
-      float distanceGreen = sqrt(pow(gxConv[1], 2) + pow(gyConv[1], 2));
-      float distanceBlue = sqrt(pow(gxConv[2], 2) + pow(gyConv[2], 2));
-      p.r = std::min((int) round(distanceRed), 255);
-      p.g = std::min((int) round(distanceGreen), 255);
-      p.b = std::min((int) round(distanceBlue), 255);
-      result.set(i, j, p);
+    } else {
+      sobelLanes(rows, out.data(), 3, (_width - 1) * 3, 3, magnitude);
+    }
+    borderPixel(i, 0);
+    if (_width > 1) {
+      borderPixel(i, _width - 1);
     }
+    dst.unpackRow(i, out.data());
   }
-  return result;
 }
 
 Image Image::bitMap() const {
-  Image result(_width, _height);
-  int kernel[9] = {1, 1, 1, 1, 1, 1, 1, 1, 1};
+  Image result(_width, _height, _layout);
+  std::vector<unsigned char> buffers[3];
   // copy over edge pixels
   for (int k = 0; k < _width; k++) {
     result.set(0, k, get(0, k));
@@ -595,10 +2156,14 @@ Image Image::bitMap() const {
   }
   // only convolve on middle pixels to prevent edge cases
   for (int i = 1; i < _height - 1; i += 2) {
+    const unsigned char* rows[3];
+    for (int m = 0; m < 3; m++) {
+      rows[m] = packedRow(i + m - 1, buffers[m]);
+    }
     for (int j = 1; j < _width - 1; j += 2) {
       int conv[3] = {0, 0, 0};  // sum of convolved area, component-wise
-      struct Pixel p = get(i, j);
-      convolve(kernel, conv, i, j, MIDDLE);
+      struct Pixel p;
+      Convolve<3, Box3>::interior(rows, j, conv);
       p.r = (int) (conv[0] / 9.0);
       p.g = (int) (conv[1] / 9.0);
       p.b = (int) (conv[2] / 9.0);
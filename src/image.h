@@ -8,8 +8,11 @@
 #ifndef AGL_IMAGE_H_
 #define AGL_IMAGE_H_
 
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <vector>
+#include "codec.h"
 
 namespace agl {
 
@@ -23,8 +26,74 @@ struct Pixel {
     unsigned char b;
 };
 
-// used in convolutions to specify location of pixel
-enum Position {MIDDLE, CORNER, EDGE};
+// internal storage of the pixels:
+//   PACKED_RGB = r,g,b per pixel, 3 bytes (same as the .png data)
+//   RGBA8 = r,g,b plus an unused pad byte, 4 bytes per pixel
+//   PLANAR = all reds, then all greens, then all blues
+// the byte-wise filters (add, invert, alphaBlend, ...) move a third more
+// memory in RGBA8, so it only pays off for per-pixel work like grayscale,
+// where each pixel fills a 32-bit lane
+enum PixelLayout {PACKED_RGB, RGBA8, PLANAR};
+
+// how sobelEdge combines the gradients gx and gy of a channel:
+//   EDGE_EXACT = round(sqrt(gx^2 + gy^2)), clamped to 255
+//   EDGE_L1 = |gx| + |gy|, clamped to 255 (cheaper, stronger on diagonals)
+enum EdgeMagnitude {EDGE_EXACT, EDGE_L1};
+
+// how blend combines each channel value a of this image with the matching
+// value b of the other image, all clamped to [0, 255]:
+//   BLEND_ADD = a + b, BLEND_SUBTRACT = a - b, BLEND_MULTIPLY = a * b,
+//   BLEND_DIFFERENCE = |a - b|, BLEND_LIGHTEST = max(a, b),
+//   BLEND_DARKEST = min(a, b),
+//   BLEND_ALPHA = (b * alpha + a * (255 - alpha)) / 255 for an alpha in
+//       [0, 255], rounded to nearest in exact integer arithmetic
+enum BlendMode {BLEND_ADD, BLEND_SUBTRACT, BLEND_MULTIPLY, BLEND_DIFFERENCE,
+    BLEND_LIGHTEST, BLEND_DARKEST, BLEND_ALPHA};
+
+/**
+ * @brief Non-owning window onto packed RGB rows
+ *
+ * A view is a pointer to its top left pixel, a size and the bytes from one
+ * row to the next, so a sub-rectangle of a larger image (see Image::view)
+ * or the pixels of a memory-mapped file (see MappedFile) can be read and
+ * cropped without copying. The pixels must outlive the view.
+ */
+class ImageView {
+ public:
+  ImageView();  // empty view
+  ImageView(const unsigned char* data, int width, int height, int64_t stride);
+
+  int width() const;
+  int height() const;
+
+  // bytes from one row to the next (at least width * 3)
+  int64_t stride() const;
+
+  // return the first pixel byte, or NULL if the view is empty
+  const unsigned char* data() const;
+
+  // return the first byte of the given row
+  const unsigned char* row(int row) const;
+
+  // whether the view has no pixels
+  bool empty() const;
+
+  // return the pixel at (row, col)
+  Pixel get(int row, int col) const;
+
+  // return the w x h region with top left (x, y), clamped to the view,
+  // without copying
+  ImageView view(int x, int y, int w, int h) const;
+
+  // save the view's pixels (format from the extension, see ImageFormat)
+  bool save(const std::string& filename, bool flip = false) const;
+
+ private:
+  const unsigned char* _data = NULL;
+  int _width = 0;
+  int _height = 0;
+  int64_t _stride = 0;
+};
 
 /**
  * @brief Implements loading, modifying, and saving RGB images
@@ -33,8 +102,12 @@ class Image {
  public:
   Image();
   Image(int width, int height);  // mallocs _pixels based on width and height
+  Image(int width, int height, PixelLayout layout);
   Image(const Image& orig);
   Image& operator=(const Image& orig);
+  Image(Image&& orig) noexcept;  // takes orig's pixels, leaving it empty
+  Image& operator=(Image&& orig) noexcept;
+  explicit Image(const ImageView& view);  // packed RGB copy of the view
 
   virtual ~Image();
 
@@ -43,17 +116,74 @@ class Image {
    * @param filename The file to load, relative to the running directory
    * @param flip Whether the file should flipped vertically when loaded
    *
+   * .ppm and .qoi files are read straight into the pixels; other formats
+   * are decoded with stb. Raw files have no size, so use loadRaw for them
+   *
    * @verbinclude sprites.cpp
    */
   bool load(const std::string& filename, bool flip = false);
 
   /**
-   * @brief Save the image to the given filename (.png)
+   * @brief Load a raw file of packed RGB rows (as written by save to .raw)
+   * @param width The number of pixels per row
+   * @param height The number of rows
+   * @param flip Whether the file should flipped vertically when loaded
+   */
+  bool loadRaw(const std::string& filename, int width, int height,
+      bool flip = false);
+
+  /**
+   * @brief Load the given filename into the given pixel layout
+   *
+   * The file data is converted once here, so filters work directly on the
+   * layout afterwards
+   */
+  bool load(const std::string& filename, PixelLayout layout,
+      bool flip = false);
+
+  /**
+   * @brief Save the image to the given filename
    * @param filename The file to load, relative to the running directory
    * @param flip Whether the file should flipped vertically before being saved
+   *
+   * The format comes from the extension (see ImageFormat): .raw, .rgb and
+   * .ppm write the pixel rows as they are, .qoi is a fast lossless format,
+   * and anything else is saved as .png
    */
   bool save(const std::string& filename, bool flip = false) const;
 
+  /**
+   * @brief Save the image to the given filename in the given format
+   * @param format The file format, or FORMAT_AUTO to use the extension
+   * @param flip Whether the file should flipped vertically before being saved
+   */
+  bool save(const std::string& filename, ImageFormat format,
+      bool flip = false) const;
+
+  /**
+   * @brief Save the image to the given filename (.png) with the built-in
+   * encoder, which can compress bands of rows on several threads
+   * @param options The compression level, row filter and threads
+   * @param flip Whether the file should flipped vertically before being saved
+   */
+  bool save(const std::string& filename, const PngOptions& options,
+      bool flip = false) const;
+
+  /**
+   * @brief Save a region of the image to the given filename (format from
+   * the extension, as above)
+   * @param filename The file to save, relative to the running directory
+   * @param x The column of the region's top left pixel
+   * @param y The row of the region's top left pixel
+   * @param w The region width in pixels
+   * @param h The region height in pixels
+   * @param flip Whether the region should flipped vertically before being saved
+   *
+   * The region is written straight from the image rows, without a copy
+   */
+  bool save(const std::string& filename, int x, int y, int w, int h,
+      bool flip = false) const;
+
   /** @brief Return the image width in pixels
    */
   int width() const;
@@ -63,19 +193,43 @@ class Image {
   int height() const;
 
   /**
-   * @brief Return the RGB data
+   * @brief Return the pixel data
    *
-   * Data will have size width * height * 3 (RGB)
+   * For PACKED_RGB, data will have size width * height * 3 (RGB). Other
+   * layouts return their own storage (see layout())
    */
   char* data() const;
 
+  /**
+   * @brief Return a view of the whole image without copying
+   *
+   * Only packed RGB images can be viewed; others return an empty view
+   */
+  ImageView view() const;
+
+  /**
+   * @brief Return a view of the w x h region with top left (x, y), clamped
+   * to the image, without copying (packed RGB images only)
+   */
+  ImageView view(int x, int y, int w, int h) const;
+
+  /** @brief Return the internal pixel layout
+   */
+  PixelLayout layout() const;
+
+  /**
+   * @brief Return a copy of the image stored in the given layout
+   */
+  Image convert(PixelLayout layout) const;
+
   /**
    * @brief Replace image RGB data
    * @param width The new image width
    * @param height The new image height
    *
    * This call will replace the old data with the new data. Data should
-   * match the size width * height * 3
+   * match the size width * height * 3 (RGB) and is converted to the
+   * current layout
    */
   void set(int width, int height, unsigned char* data);
 
@@ -103,7 +257,7 @@ class Image {
   *
   * Pixel colors are unsigned char, e.g. in range 0 to 255
   */
-  Pixel get(int i) const;
+  Pixel get(int64_t i) const;
 
   /**
   * @brief Set the pixel RGB color at index i
@@ -111,7 +265,36 @@ class Image {
   *
   * Pixel colors are unsigned char, e.g. in range 0 to 255
   */
-  void set(int i, const Pixel& c);
+  void set(int64_t i, const Pixel& c);
+
+  /**
+   * @brief Set every pixel to the given color
+   */
+  void fill(const Pixel& color);
+
+  /**
+   * @brief Set the pixels in columns x0 through x1 (inclusive) of a row
+   * @param row The row (value between 0 and height-1)
+   * @param x0 The first column (value between 0 and width-1)
+   * @param x1 The last column (value between x0 and width-1)
+   */
+  void fillSpan(int row, int x0, int x1, const Pixel& color);
+
+  /**
+   * @brief Blend a color over the pixels in columns x0 through x1 of a row
+   *
+   * Each pixel becomes color * alpha + pixel * (255 - alpha), divided by
+   * 255 and rounded, the same as blend with BLEND_ALPHA
+   * @param alpha The opacity of color (0 leaves the row, 255 is fillSpan)
+   */
+  void blendSpan(int row, int x0, int x1, const Pixel& color, int alpha);
+
+  /**
+   * @brief Set the pixels in the w x h rectangle with top left (x, y)
+   *
+   * The rectangle is clamped to the image
+   */
+  void fillRect(int x, int y, int w, int h, const Pixel& color);
 
   // resize the image
   Image resize(int width, int height) const;
@@ -128,15 +311,44 @@ class Image {
   // Replace the portion starting at (row, col) with the given image
   // Clamps the image if it doesn't fit on this image
   void replace(const Image& image, int x, int y);
+  void replace(const ImageView& view, int x, int y);
 
-  // Apply gamma correction
+  // Replace each channel value v with lut[channel][v] (0 = red, 1 = green,
+  // 2 = blue)
+  Image applyLUT(const uint8_t lut[3][256]) const;
+  void applyLUTInto(const uint8_t lut[3][256], Image& dst) const;
+  void applyLUTInPlace(const uint8_t lut[3][256]);
+
+  // Apply gamma correction (with a cached table per gamma value)
   Image gammaCorrect(float gamma) const;
 
+  // Add delta to every channel, clamping to [0, 255]
+  Image brightness(int delta) const;
+
+  // Scale every channel's distance from 128 by factor, clamping to [0, 255]
+  Image contrast(float factor) const;
+
   // Apply the following calculation to the pixels in
   // our image and the given image:
   //    this.pixels = this.pixels * (1-alpha) + other.pixel * alpha
   // Assumes that the two images are the same size
   Image alphaBlend(const Image& other, float alpha) const;
+  Image alphaBlend(const ImageView& other, float alpha) const;
+
+  // Combine the image with another of the same size (see BlendMode); alpha
+  // is only used by BLEND_ALPHA. The Into and InPlace versions work like
+  // the ones below
+  Image blend(const Image& other, BlendMode mode, int alpha = 255) const;
+  void blendInto(const Image& other, BlendMode mode, Image& dst,
+      int alpha = 255) const;
+  void blendInPlace(const Image& other, BlendMode mode, int alpha = 255);
+
+  // The same with the other pixels read from a view of the same size, e.g.
+  // a crop of a larger image or a mapped file
+  Image blend(const ImageView& other, BlendMode mode, int alpha = 255) const;
+  void blendInto(const ImageView& other, BlendMode mode, Image& dst,
+      int alpha = 255) const;
+  void blendInPlace(const ImageView& other, BlendMode mode, int alpha = 255);
 
   // Convert the image to grayscale
   Image grayscale() const;
@@ -195,36 +407,125 @@ class Image {
   // 3 = blue
   Image extractChannel(int channel) const;
 
-  // box blur image with convolution
-  Image blur() const;
+  // box blur: average the (2 * radius + 1)^2 neighborhood of each pixel,
+  // over only the pixels inside the image near the edges. Any radius works;
+  // past max(width, height) the result is the plain average of the image
+  Image blur(int radius = 1) const;
+
+  // Variants of the filters above that write into dst instead of returning
+  // a new image. dst is resized to match this image, reusing its pixel
+  // buffer when it already has the same size and layout, so a chain of
+  // filters can ping-pong between two images without allocating. For the
+  // per-pixel filters dst may be this image (see the InPlace versions);
+  // blurInto and sobelEdgeInto need a different dst
+  void alphaBlendInto(const Image& other, float alpha, Image& dst) const;
+  void grayscaleInto(Image& dst) const;
+  void addInto(const Image& other, Image& dst) const;
+  void subtractInto(const Image& other, Image& dst) const;
+  void invertInto(Image& dst) const;
+  void swirlInto(Image& dst) const;
+  void extractChannelInto(int channel, Image& dst) const;
+  void blurInto(Image& dst, int radius = 1) const;
+  void sobelEdgeInto(Image& dst,
+      EdgeMagnitude magnitude = EDGE_EXACT) const;
+
+  // In-place versions of the per-pixel filters
+  void alphaBlendInPlace(const Image& other, float alpha);
+  void alphaBlendInto(const ImageView& other, float alpha, Image& dst) const;
+  void alphaBlendInPlace(const ImageView& other, float alpha);
+  void grayscaleInPlace();
+  void addInPlace(const Image& other);
+  void subtractInPlace(const Image& other);
+  void invertInPlace();
+  void swirlInPlace();
+  void extractChannelInPlace(int channel);
 
   // convert pixel to white if at or above threshold, else convert to black
   Image extractWhite(int threshold) const;
+  void extractWhiteInto(int threshold, Image& dst) const;
+  void extractWhiteInPlace(int threshold);
 
-  // add glow effect to image (extractWhite + alphaBlend)
-  Image glow(int threshold) const;
+  // add glow effect to image (extractWhite + blur + alphaBlend), where the
+  // alpha of each pixel is the brightness of its blurred highlight / 2
+  Image glow(int threshold, int radius = 1) const;
+
+  // glow into dst, reusing whitened for the highlights; dst, whitened and
+  // this image must be three different images
+  void glowInto(Image& dst, Image& whitened, int threshold,
+      int radius = 1) const;
 
   // sobel edge detection
-  Image sobelEdge() const;
+  Image sobelEdge(EdgeMagnitude magnitude = EDGE_EXACT) const;
 
   // averages a 3x3 neighborhood of pixels and colors them all the same
   Image bitMap() const;
 
  private:
+  friend class Pipeline;  // works on bands of rows through the helpers below
+
   int _width = 0;  // number of columns (in pixels)
   int _height = 0;  // number of rows (in pixels)
   int _components = 0; // number of components in original image file
-  // internally use struct Pixel *, externally accept/return as unsigned char *
-  struct Pixel * _pixels = NULL;  // internal representation of pixel data
-  bool _use_stbi_free = false;  // use stbi_image_free instead of delete
+  PixelLayout _layout = PACKED_RGB;  // how _pixels is arranged
+  // bytes in _layout order; packed RGB can be cast to struct Pixel *
+  unsigned char * _pixels = NULL;  // internal representation of pixel data
 
   // free memory pointed to by _pixels
   void resetPixels();
 
-  // apply a 3x3 matrix to a pixel and return convolution with pixel at (i,j),
-  // with component-wise sums in the result matrix
-  int* convolve(const int * matrix, int * result, int i, int j,
-      Position position) const;
+  // make this a width x height image in the given layout, keeping the
+  // current buffer if it already fits (pixel values are not preserved)
+  void reshape(int width, int height, PixelLayout layout);
+
+  // allocate a 64-byte aligned buffer for _width x _height in _layout
+  void allocPixels();
+
+  // number of bytes used by _pixels
+  int64_t byteSize() const;
+
+  // return row as packed RGB, either in place or converted into buffer
+  const unsigned char* packedRow(int row,
+      std::vector<unsigned char>& buffer) const;
+
+  // set row from packed RGB data
+  void unpackRow(int row, const unsigned char* packed);
+
+  // copy rows [srcRow, srcRow + rows) of src to the rows starting at dstRow;
+  // src must have the same width
+  void copyRows(const Image& src, int srcRow, int dstRow, int rows);
+  void copyRows(const ImageView& src, int srcRow, int dstRow, int rows);
+
+  // set count pixels starting at index start to color c
+  void fillRange(int64_t start, int64_t count, const Pixel& c);
+
+  // blend color c with opacity alpha over count pixels starting at start
+  void blendRange(int64_t start, int64_t count, const Pixel& c, int alpha);
+
+  // write the grayscale of count pixels from start into dst, one by one
+  void grayscaleRange(Image& dst, int64_t start, int64_t count) const;
+
+  // fill lut with the gammaCorrect table for gamma, from a shared cache
+  static void gammaLUT(float gamma, uint8_t lut[3][256]);
+
+  // whether every pixel has r = g = b
+  bool isGray() const;
+
+  // copy the pixels of a w x h region with top left (x, y) into dst as
+  // packed RGB rows
+  void packRegion(unsigned char* dst, int x, int y, int w, int h) const;
+
+  // save the w x h region with top left (x, y), which lies inside the image
+  bool saveRegion(const std::string& filename, ImageFormat format, int x,
+      int y, int w, int h, bool flip) const;
+
+  // read a .ppm or .qoi file into packed RGB pixels; false if the file is
+  // missing or not in the given format
+  bool loadFormat(const std::string& filename, ImageFormat format,
+      bool flip);
+
+  // copy the rows of a view of a mapped file (the same size as this
+  // image), bottom up if flip
+  void copyMapped(const ImageView& pixels, bool flip);
 
   // helper to alpha blend one pixel with a specific alpha using:
   //   this.pixels = this.pixels * (1-alpha) + other.pixel * alpha
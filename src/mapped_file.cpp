@@ -0,0 +1,123 @@
+/* mapped_file.cpp
+ * Implementation of a MappedFile class that maps raw and .ppm files into
+ * memory so their pixels can be viewed without reading or copying them
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#include "mapped_file.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace agl;
+
+MappedFile::MappedFile() {  }
+
+MappedFile::MappedFile(const string& filename) {
+  open(filename);
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const string& filename) {
+  close();
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+  if (data == NULL) {
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return false;
+  }
+  _file = file;
+  _mapping = mapping;
+  _size = size.QuadPart;
+#else
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // the mapping keeps the file open
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  _size = info.st_size;
+#endif
+  _data = (const unsigned char*) data;
+  return true;
+}
+
+void MappedFile::close() {
+  if (_data == NULL) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(_data);
+  CloseHandle(_mapping);
+  CloseHandle(_file);
+  _file = NULL;
+  _mapping = NULL;
+#else
+  munmap((void*) _data, _size);
+#endif
+  _data = NULL;
+  _size = 0;
+}
+
+bool MappedFile::isOpen() const {
+  return _data != NULL;
+}
+
+const unsigned char* MappedFile::data() const {
+  return _data;
+}
+
+int64_t MappedFile::size() const {
+  return _size;
+}
+
+ImageView MappedFile::ppmView() const {
+  int width;
+  int height;
+  int64_t offset;
+  if (!parsePpmHeader(_data, _size, width, height, offset)) {
+    return ImageView();
+  }
+  return rawView(width, height, offset);
+}
+
+ImageView MappedFile::rawView(int width, int height, int64_t offset) const {
+  int64_t rowBytes = sizeof(struct Pixel) * (int64_t) width;
+  if (_data == NULL || width <= 0 || height <= 0 || offset < 0 ||
+      _size - offset < rowBytes * height) {
+    return ImageView();
+  }
+  return ImageView(_data + offset, width, height, rowBytes);
+}
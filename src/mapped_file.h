@@ -0,0 +1,70 @@
+/* mapped_file.h
+ * header file for mapped_file.cpp
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#ifndef AGL_MAPPED_FILE_H_
+#define AGL_MAPPED_FILE_H_
+
+#include <string>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief Maps a file into memory, read only
+ *
+ * The operating system pages the file in as it is read, so views of a
+ * large raw or .ppm file cost nothing until their pixels are used, and
+ * only the touched pages take up memory.
+ *
+ *   MappedFile file("texture.ppm");
+ *   ImageView tile = file.ppmView().view(4096, 8192, 512, 512);
+ *   Image result = canvas.image().blend(tile, BLEND_MULTIPLY);
+ *
+ * Views returned by the file are valid until it is closed or destroyed.
+ */
+class MappedFile {
+ public:
+  MappedFile();
+  explicit MappedFile(const std::string& filename);  // see open()
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // map the given file, closing any file mapped before; false if it can't
+  // be opened or is empty
+  bool open(const std::string& filename);
+
+  // unmap the file
+  void close();
+
+  // whether a file is mapped
+  bool isOpen() const;
+
+  // return the first byte of the file, or NULL if none is mapped
+  const unsigned char* data() const;
+
+  // return the number of bytes in the file
+  int64_t size() const;
+
+  // view the pixels of a binary .ppm file with 8-bit channels (P6, maxval
+  // 255); empty if the file is anything else
+  ImageView ppmView() const;
+
+  // view the file as packed RGB rows of the given size starting offset
+  // bytes in; empty if the file is too small
+  ImageView rawView(int width, int height, int64_t offset = 0) const;
+
+ private:
+  const unsigned char* _data = NULL;
+  int64_t _size = 0;
+#ifdef _WIN32
+  void* _file = NULL;  // file and mapping handles
+  void* _mapping = NULL;
+#endif
+};
+}  // namespace agl
+#endif  // AGL_MAPPED_FILE_H_
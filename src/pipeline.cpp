@@ -0,0 +1,407 @@
+/* pipeline.cpp
+ * Implementation of a Pipeline class that records Image filters and runs
+ * them band by band, so a chain of filters makes one pass over memory
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#include "pipeline.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+using namespace agl;
+
+Pipeline::Pipeline(const Image& source): _source(&source) {  }
+
+Pipeline::Pipeline(const ImageView& source): _view(source),
+    _width(source.width()), _height(source.height()) {  }
+
+// return the size of a file in bytes, or -1 if it can't be opened
+static int64_t fileBytes(const string& filename) {
+  FILE* f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    return -1;
+  }
+#ifdef _WIN32
+  _fseeki64(f, 0, SEEK_END);
+  int64_t size = _ftelli64(f);
+#else
+  fseeko(f, 0, SEEK_END);
+  int64_t size = ftello(f);
+#endif
+  fclose(f);
+  return size;
+}
+
+Pipeline::Pipeline(const string& filename): _file(filename) {
+  // the header is at the start of the file; comments rarely make it long
+  unsigned char header[1024];
+  FILE* f = fopen(filename.c_str(), "rb");
+  int64_t n = f ? fread(header, 1, sizeof(header), f) : 0;
+  if (f) {
+    fclose(f);
+  }
+  int width;
+  int height;
+  if (!parsePpmHeader(header, n, width, height, _fileOffset)) {
+    cout << "Error: " << filename << " is not an 8-bit binary .ppm file"
+        << endl;
+    return;
+  }
+  setFileSize(width, height);
+}
+
+Pipeline::Pipeline(const string& filename, int width, int height):
+    _file(filename) {
+  setFileSize(width, height);
+}
+
+void Pipeline::setFileSize(int width, int height) {
+  int64_t needed = _fileOffset + (int64_t) sizeof(struct Pixel) *
+      max(width, 0) * max(height, 0);
+  if (fileBytes(_file) < needed) {
+    // leave the pipeline empty rather than read past the end
+    cout << "Error: " << _file << " is too small for " << width << "x"
+        << height << " pixels" << endl;
+    return;
+  }
+  _width = max(width, 0);
+  _height = max(height, 0);
+}
+
+int Pipeline::width() const {
+  return _source ? _source->width() : _width;
+}
+
+int Pipeline::height() const {
+  return _source ? _source->height() : _height;
+}
+
+PixelLayout Pipeline::layout() const {
+  return _source ? _source->layout() : PACKED_RGB;
+}
+
+Pipeline& Pipeline::push(StageType type) {
+  Stage stage;
+  stage.type = type;
+  _stages.push_back(stage);
+  return *this;
+}
+
+Pipeline& Pipeline::applyLUT(const uint8_t lut[3][256]) {
+  push(LUT);
+  memcpy(_stages.back().lut, lut, sizeof(_stages.back().lut));
+  return *this;
+}
+
+Pipeline& Pipeline::gammaCorrect(float gamma) {
+  push(LUT);
+  Image::gammaLUT(gamma, _stages.back().lut);
+  return *this;
+}
+
+Pipeline& Pipeline::grayscale() {
+  return push(GRAYSCALE);
+}
+
+Pipeline& Pipeline::invert() {
+  return push(INVERT);
+}
+
+Pipeline& Pipeline::swirl() {
+  return push(SWIRL);
+}
+
+Pipeline& Pipeline::extractChannel(int channel) {
+  if (channel < 1 || channel > 3) {
+    // no change if invalid channel, so no stage either
+    cout << "Invalid channel: " << channel << endl;
+    return *this;
+  }
+  push(CHANNEL);
+  _stages.back().param = channel;
+  return *this;
+}
+
+Pipeline& Pipeline::extractWhite(int threshold) {
+  push(WHITE);
+  _stages.back().param = threshold;
+  return *this;
+}
+
+Pipeline& Pipeline::add(const Image& other) {
+  return blend(other, BLEND_ADD);
+}
+
+Pipeline& Pipeline::subtract(const Image& other) {
+  return blend(other, BLEND_SUBTRACT);
+}
+
+Pipeline& Pipeline::blend(const Image& other, BlendMode mode, int alpha) {
+  push(MODE);
+  _stages.back().other = &other;
+  _stages.back().param = mode;
+  _stages.back().alpha = alpha;
+  return *this;
+}
+
+Pipeline& Pipeline::alphaBlend(const Image& other, float alpha) {
+  push(BLEND);
+  _stages.back().other = &other;
+  _stages.back().alpha = alpha;
+  return *this;
+}
+
+Pipeline& Pipeline::blend(const ImageView& other, BlendMode mode,
+    int alpha) {
+  push(MODE);
+  _stages.back().otherView = other;
+  _stages.back().param = mode;
+  _stages.back().alpha = alpha;
+  return *this;
+}
+
+Pipeline& Pipeline::alphaBlend(const ImageView& other, float alpha) {
+  push(BLEND);
+  _stages.back().otherView = other;
+  _stages.back().alpha = alpha;
+  return *this;
+}
+
+Pipeline& Pipeline::blur(int radius) {
+  push(BLUR);
+  _stages.back().param = radius;
+  _stages.back().halo = max(radius, 0);  // rows of the box above and below
+  return *this;
+}
+
+Pipeline& Pipeline::glow(int threshold, int radius) {
+  push(GLOW);
+  _stages.back().param = radius;
+  _stages.back().threshold = threshold;
+  _stages.back().halo = max(radius, 0);  // rows of the blur box
+  return *this;
+}
+
+Pipeline& Pipeline::sobelEdge(EdgeMagnitude magnitude) {
+  push(SOBEL);
+  _stages.back().param = magnitude;
+  _stages.back().halo = 1;  // 3x3 kernels
+  return *this;
+}
+
+void Pipeline::setThreads(int threads) {
+  _threads = max(threads, 1);
+}
+
+void Pipeline::setBandRows(int rows) {
+  _bandRows = max(rows, 0);
+}
+
+Image Pipeline::run() const {
+  Image result;
+  runInto(result);
+  return result;
+}
+
+void Pipeline::runInto(Image& dst) const {
+  if (&dst == _source) {
+    cout << "Error: Pipeline can't run into its own source image" << endl;
+    return;
+  }
+  dst.reshape(width(), height(), layout());
+  // bands write disjoint rows of dst
+  runBands([&](const Image& band, int y0) {
+    dst.copyRows(band, 0, y0, band.height());
+  });
+}
+
+bool Pipeline::runToFile(const string& filename, ImageFormat format) const {
+  if (format == FORMAT_AUTO) {
+    format = formatFromName(filename);
+  }
+  if (format != FORMAT_RAW && format != FORMAT_PPM) {
+    cout << "Error: runToFile writes .raw or .ppm files" << endl;
+    return false;
+  }
+  if (filename == _file) {
+    cout << "Error: Pipeline can't run into its own source file" << endl;
+    return false;
+  }
+  if (width() == 0 || height() == 0) {
+    return false;  // nothing to write
+  }
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  string header = (format == FORMAT_PPM) ? ppmHeader(width(), height()) : "";
+  bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+  int64_t rowBytes = (int64_t) sizeof(struct Pixel) * width();
+  mutex fileLock;
+  // bands may finish out of order, so each one seeks to its own rows
+  runBands([&](const Image& band, int y0) {
+    vector<unsigned char> buffer;
+    lock_guard<mutex> lock(fileLock);
+    int64_t offset = header.size() + rowBytes * y0;
+#ifdef _WIN32
+    ok = ok && _fseeki64(f, offset, SEEK_SET) == 0;
+#else
+    ok = ok && fseeko(f, offset, SEEK_SET) == 0;
+#endif
+    for (int i = 0; ok && i < band.height(); i++) {
+      ok = fwrite(band.packedRow(i, buffer), 1, rowBytes, f) ==
+          (size_t) rowBytes;
+    }
+  });
+  return (fclose(f) == 0) && ok;
+}
+
+void Pipeline::runBands(
+    const function<void(const Image& band, int y0)>& consume) const {
+  int width = this->width();
+  int height = this->height();
+  int rows = _bandRows;
+  if (rows == 0) {
+    // about 256 KB of pixels per band, so a band stays in L2 while every
+    // stage runs over it
+    int64_t rowBytes = max((int64_t) width * 4, (int64_t) 1);
+    rows = max((int) (256 * 1024 / rowBytes), 8);
+  }
+  int numBands = (height + rows - 1) / rows;
+  // workers take the next unclaimed band until none are left
+  atomic<int> nextBand(0);
+  auto worker = [&]() {
+    Scratch scratch;
+    scratch.bands.resize(_stages.size());
+    scratch.others.resize(_stages.size());
+    Image band;
+    for (int t = nextBand++; t < numBands; t = nextBand++) {
+      int y0 = t * rows;
+      int y1 = min(y0 + rows, height);
+      produce(_stages.size(), y0, y1, band, scratch);
+      consume(band, y0);
+    }
+    if (scratch.file != NULL) {
+      fclose(scratch.file);
+    }
+  };
+  int numWorkers = min(_threads, numBands);
+  vector<thread> pool;
+  for (int i = 1; i < numWorkers; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();  // calling thread also processes bands
+  for (thread& t : pool) {
+    t.join();
+  }
+}
+
+void Pipeline::produce(int count, int y0, int y1, Image& band,
+    Scratch& scratch) const {
+  int width = this->width();
+  if (count == 0) {
+    // first stage reads straight from the source
+    band.reshape(width, y1 - y0, layout());
+    if (_source) {
+      band.copyRows(*_source, y0, 0, y1 - y0);
+    } else if (!_file.empty()) {
+      readRows(y0, y1, band, scratch);
+    } else {
+      band.copyRows(_view, y0, 0, y1 - y0);
+    }
+    return;
+  }
+  const Stage& stage = _stages[count - 1];
+  // glow always takes the neighborhood path, which also blends its
+  // highlights back over the band
+  if (stage.halo == 0 && stage.type != GLOW) {
+    produce(count - 1, y0, y1, band, scratch);
+    apply(stage, y0, band, scratch.others[count - 1]);
+    return;
+  }
+  // neighborhood filter: produce the band with its halo, filter that, and
+  // keep the rows inside [y0, y1). Rows at the edge of the extended band are
+  // only treated as image edges where they really are the image edge
+  int start = max(y0 - stage.halo, 0);
+  int end = min(y1 + stage.halo, height());
+  Image& input = scratch.bands[count - 1];
+  Image& filtered = scratch.others[count - 1];
+  produce(count - 1, start, end, input, scratch);
+  if (stage.type == BLUR) {
+    input.blurInto(filtered, stage.param);
+  } else if (stage.type == GLOW) {
+    input.glowInto(filtered, scratch.highlights, stage.threshold,
+        stage.param);
+  } else {
+    input.sobelEdgeInto(filtered, (EdgeMagnitude) stage.param);
+  }
+  band.reshape(width, y1 - y0, filtered.layout());
+  band.copyRows(filtered, y0 - start, 0, y1 - y0);
+}
+
+void Pipeline::readRows(int y0, int y1, Image& band, Scratch& scratch) const {
+  if (scratch.file == NULL) {
+    // each thread reads through its own handle, so no locking is needed
+    scratch.file = fopen(_file.c_str(), "rb");
+  }
+  int64_t rowBytes = (int64_t) sizeof(struct Pixel) * band.width();
+  int64_t offset = _fileOffset + rowBytes * y0;
+  size_t bytes = rowBytes * (y1 - y0);
+  bool ok = scratch.file != NULL;
+#ifdef _WIN32
+  ok = ok && _fseeki64(scratch.file, offset, SEEK_SET) == 0;
+#else
+  ok = ok && fseeko(scratch.file, offset, SEEK_SET) == 0;
+#endif
+  // band is packed RGB, so the rows go straight into its pixels
+  if (!ok || fread(band.data(), 1, bytes, scratch.file) != bytes) {
+    cout << "Error: can't read rows " << y0 << " to " << y1 - 1 << " of "
+        << _file << endl;
+    band.fill(Pixel{0, 0, 0});
+  }
+}
+
+void Pipeline::apply(const Stage& stage, int y0, Image& band,
+    Image& other) const {
+  if (stage.other != NULL) {
+    // matching rows of the second image
+    other.reshape(band.width(), band.height(), stage.other->layout());
+    other.copyRows(*stage.other, y0, 0, band.height());
+  } else if (!stage.otherView.empty()) {
+    other.reshape(band.width(), band.height(), band.layout());
+    other.copyRows(stage.otherView, y0, 0, band.height());
+  }
+  switch (stage.type) {
+    case LUT:
+      band.applyLUTInPlace(stage.lut);
+      break;
+    case GRAYSCALE:
+      band.grayscaleInPlace();
+      break;
+    case INVERT:
+      band.invertInPlace();
+      break;
+    case SWIRL:
+      band.swirlInPlace();
+      break;
+    case CHANNEL:
+      band.extractChannelInPlace(stage.param);
+      break;
+    case WHITE:
+      band.extractWhiteInPlace(stage.param);
+      break;
+    case MODE:
+      band.blendInPlace(other, (BlendMode) stage.param, stage.alpha);
+      break;
+    case BLEND:
+      band.alphaBlendInPlace(other, stage.alpha);
+      break;
+    default:
+      break;
+  }
+}
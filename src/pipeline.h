@@ -0,0 +1,154 @@
+/* pipeline.h
+ * header file for pipeline.cpp
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#ifndef AGL_PIPELINE_H_
+#define AGL_PIPELINE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief Records a chain of Image filters and runs them in one pass
+ *
+ * Filters are only recorded when called. run() walks the image in bands of
+ * rows and applies every recorded filter to a band while it is still in
+ * cache, so a chain of per-pixel filters reads and writes each pixel of the
+ * frame once instead of once per filter.
+ *
+ * Neighborhood filters (blur, sobelEdge) are barriers: each band recomputes
+ * the rows above and below it that the filter reads (its halo), so bands
+ * stay independent. Results match the Image filters pixel for pixel.
+ *
+ *   Image out = Pipeline(img).gammaCorrect(2.2f).grayscale().invert().run();
+ *
+ * The source and the second image of add, subtract or the blends may also
+ * be views (see ImageView), e.g. a tile of a mapped file: each band copies
+ * only its own rows out of them. The source image and any image passed to
+ * add, subtract or the blends must outlive the pipeline and have the same
+ * size as the source.
+ *
+ * For images larger than memory, the source can be a .ppm or raw file that
+ * is read a band at a time, and runToFile writes each band as it is done,
+ * so memory use depends on the band size and threads, not the image size:
+ *
+ *   Pipeline("map.ppm").blur().sobelEdge().runToFile("edges.ppm");
+ */
+class Pipeline {
+ public:
+  explicit Pipeline(const Image& source);
+  explicit Pipeline(const ImageView& source);  // output is packed RGB
+
+  // read the source rows from a binary .ppm file (8-bit P6), or from a raw
+  // file of packed RGB rows of the given size, as bands are processed;
+  // output is packed RGB
+  explicit Pipeline(const std::string& filename);
+  Pipeline(const std::string& filename, int width, int height);
+
+  // per-pixel filters, same as the Image filters of the same name
+  Pipeline& applyLUT(const uint8_t lut[3][256]);
+  Pipeline& gammaCorrect(float gamma);
+  Pipeline& grayscale();
+  Pipeline& invert();
+  Pipeline& swirl();
+  Pipeline& extractChannel(int channel);
+  Pipeline& extractWhite(int threshold);
+  Pipeline& add(const Image& other);
+  Pipeline& subtract(const Image& other);
+  Pipeline& alphaBlend(const Image& other, float alpha);
+  Pipeline& blend(const Image& other, BlendMode mode, int alpha = 255);
+  Pipeline& alphaBlend(const ImageView& other, float alpha);
+  Pipeline& blend(const ImageView& other, BlendMode mode, int alpha = 255);
+
+  // neighborhood filters (barriers)
+  Pipeline& blur(int radius = 1);
+  Pipeline& glow(int threshold, int radius = 1);
+  Pipeline& sobelEdge(EdgeMagnitude magnitude = EDGE_EXACT);
+
+  // number of threads that process bands (default 1)
+  void setThreads(int threads);
+
+  // rows per band; 0 (default) picks about 256 KB of pixels per band
+  void setBandRows(int rows);
+
+  // evaluate the recorded filters into a new image
+  Image run() const;
+
+  // evaluate the recorded filters into dst, reusing its buffer if it
+  // already has the right size and layout; dst must not be the source
+  void runInto(Image& dst) const;
+
+  // evaluate the recorded filters and write each band to a .raw or .ppm
+  // file as soon as it is done, so only the bands being processed are in
+  // memory; filename must not be the source file
+  bool runToFile(const std::string& filename,
+      ImageFormat format = FORMAT_AUTO) const;
+
+ private:
+  enum StageType {LUT, GRAYSCALE, INVERT, SWIRL, CHANNEL, WHITE, MODE,
+      BLEND, BLUR, GLOW, SOBEL};
+
+  struct Stage {
+    StageType type;
+    // channel, threshold, blur radius, edge magnitude or blend mode
+    int param = 0;
+    float alpha = 0;  // blend factor (0 to 1 for alphaBlend, 0 to 255 blend)
+    const Image* other = NULL;  // second image of blends
+    ImageView otherView;  // or a view of it, if other is NULL
+    int halo = 0;  // rows above and below read by a neighborhood filter
+    int threshold = 0;  // extractWhite threshold of glow
+    uint8_t lut[3][256];  // per-channel tables for applyLUT, gammaCorrect
+  };
+
+  // per-thread buffers: one band (and one band of other) per stage
+  struct Scratch {
+    std::vector<Image> bands;
+    std::vector<Image> others;
+    Image highlights;  // whitened input of a glow stage
+    FILE* file = NULL;  // this thread's handle on the source file
+  };
+
+  const Image* _source = NULL;  // source image, or NULL for a view or file
+  ImageView _view;
+  std::string _file;  // source file, read a band at a time
+  int64_t _fileOffset = 0;  // bytes before the first row of _file
+  int _width = 0;  // size of a view or file source
+  int _height = 0;
+  std::vector<Stage> _stages;
+  int _threads = 1;
+  int _bandRows = 0;
+
+  Pipeline& push(StageType type);
+
+  // size and layout of the source (a view's rows are packed RGB)
+  int width() const;
+  int height() const;
+  PixelLayout layout() const;
+
+  // evaluate the recorded filters band by band on _threads threads and
+  // pass each band to consume with its first row (from any thread)
+  void runBands(
+      const std::function<void(const Image& band, int y0)>& consume) const;
+
+  // use a file source of the given size if the file is large enough
+  void setFileSize(int width, int height);
+
+  // read rows [y0, y1) of the source file into band
+  void readRows(int y0, int y1, Image& band, Scratch& scratch) const;
+
+  // fill band with rows [y0, y1) of the image after the first count stages
+  void produce(int count, int y0, int y1, Image& band, Scratch& scratch) const;
+
+  // apply a per-pixel stage to band, which holds rows starting at y0
+  void apply(const Stage& stage, int y0, Image& band, Image& other) const;
+};
+}  // namespace agl
+#endif  // AGL_PIPELINE_H_
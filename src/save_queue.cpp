@@ -0,0 +1,101 @@
+/* save_queue.cpp
+ * Implementation of a SaveQueue class that copies frames into pooled
+ * buffers and saves them to files on worker threads
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#include "save_queue.h"
+
+using namespace std;
+using namespace agl;
+
+SaveQueue::SaveQueue(int threads, int capacity) {
+  threads = max(threads, 1);
+  _maxFrames = threads + max(capacity, 1);
+  for (int i = 0; i < threads; i++) {
+    _workers.emplace_back(&SaveQueue::work, this);
+  }
+}
+
+SaveQueue::~SaveQueue() {
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _ready.notify_all();
+  for (thread& t : _workers) {
+    t.join();  // workers empty the queue before they stop
+  }
+}
+
+future<bool> SaveQueue::push(const Image& image, const string& filename,
+    ImageFormat format) {
+  Job job;
+  job.filename = filename;
+  job.format = format;
+  return enqueue(image, move(job));
+}
+
+future<bool> SaveQueue::push(const Image& image, const string& filename,
+    const PngOptions& options) {
+  Job job;
+  job.filename = filename;
+  job.usePngOptions = true;
+  job.options = options;
+  return enqueue(image, move(job));
+}
+
+void SaveQueue::wait() {
+  unique_lock<mutex> lock(_mutex);
+  // every frame buffer is back once the last save has finished
+  _changed.wait(lock, [&]() { return (int) _free.size() == _frames; });
+}
+
+future<bool> SaveQueue::enqueue(const Image& image, Job job) {
+  {
+    unique_lock<mutex> lock(_mutex);
+    // backpressure: wait for a frame buffer if all of them are in use
+    _changed.wait(lock, [&]() {
+      return !_free.empty() || _frames < _maxFrames;
+    });
+    if (_free.empty()) {
+      _free.emplace_back(new Image());
+      _frames++;
+    }
+    job.frame = move(_free.back());
+    _free.pop_back();
+  }
+  // copy outside the lock; the buffer is reused if it has the same size
+  *job.frame = image;
+  future<bool> result = job.done.get_future();
+  {
+    lock_guard<mutex> lock(_mutex);
+    _jobs.push_back(move(job));
+  }
+  _ready.notify_one();
+  return result;
+}
+
+void SaveQueue::work() {
+  unique_lock<mutex> lock(_mutex);
+  while (true) {
+    _ready.wait(lock, [&]() { return !_jobs.empty() || _stopping; });
+    if (_jobs.empty()) {
+      return;  // stopping and nothing left to save
+    }
+    Job job = move(_jobs.front());
+    _jobs.pop_front();
+    lock.unlock();
+    bool ok;
+    if (job.usePngOptions) {
+      ok = job.frame->save(job.filename, job.options);
+    } else {
+      ok = job.frame->save(job.filename, job.format);
+    }
+    job.done.set_value(ok);
+    lock.lock();
+    _free.push_back(move(job.frame));
+    _changed.notify_all();
+  }
+}
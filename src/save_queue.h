@@ -0,0 +1,92 @@
+/* save_queue.h
+ * header file for save_queue.cpp
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#ifndef AGL_SAVE_QUEUE_H_
+#define AGL_SAVE_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "image.h"
+
+namespace agl {
+
+/**
+ * @brief Saves images to files on background threads
+ *
+ * push() copies the image into a pooled frame buffer and returns at once,
+ * so the caller can draw the next frame while worker threads encode and
+ * write the previous ones. The future reports whether the file was written.
+ *
+ * At most threads + capacity frames are held at a time (being saved or
+ * waiting); push() blocks until one is free, so a caller that draws faster
+ * than files can be written is slowed down instead of using more memory.
+ * Frame buffers are reused, so a run of same-sized frames allocates them
+ * only once.
+ *
+ *   SaveQueue saves(2);
+ *   for (int i = 0; i < frames; i++) {
+ *     draw(canvas, i);
+ *     saves.push(canvas.image(), "frame" + std::to_string(i) + ".png");
+ *   }
+ *   saves.wait();
+ *
+ * The destructor finishes every queued save.
+ */
+class SaveQueue {
+ public:
+  // threads that save files and frames that may wait for them (at least 1)
+  explicit SaveQueue(int threads = 1, int capacity = 1);
+  ~SaveQueue();
+
+  SaveQueue(const SaveQueue&) = delete;
+  SaveQueue& operator=(const SaveQueue&) = delete;
+
+  // queue a copy of image to be saved as with Image::save(filename, format)
+  std::future<bool> push(const Image& image, const std::string& filename,
+      ImageFormat format = FORMAT_AUTO);
+
+  // queue a copy of image to be saved with the built-in PNG encoder
+  std::future<bool> push(const Image& image, const std::string& filename,
+      const PngOptions& options);
+
+  // block until every queued save has finished
+  void wait();
+
+ private:
+  struct Job {
+    std::unique_ptr<Image> frame;
+    std::string filename;
+    ImageFormat format = FORMAT_AUTO;
+    bool usePngOptions = false;  // save with options instead of format
+    PngOptions options;
+    std::promise<bool> done;
+  };
+
+  std::mutex _mutex;
+  std::condition_variable _ready;  // a job was queued, or stopping
+  std::condition_variable _changed;  // a frame buffer was returned
+  std::deque<Job> _jobs;
+  std::vector<std::unique_ptr<Image>> _free;  // frame buffers not in use
+  int _frames = 0;  // frame buffers allocated
+  int _maxFrames;
+  bool _stopping = false;
+  std::vector<std::thread> _workers;
+
+  // take a free frame buffer (or allocate one), copy image into it and
+  // queue job
+  std::future<bool> enqueue(const Image& image, Job job);
+
+  // save queued jobs until stopping and the queue is empty
+  void work();
+};
+}  // namespace agl
+#endif  // AGL_SAVE_QUEUE_H_
@@ -0,0 +1,76 @@
+/* simd.h
+ * Detects the SIMD instruction sets the compiler targets so rasterizers
+ * and filters can choose a vectorized path at compile time, and the ones
+ * the running CPU adds on top of that at run time
+ * @author JL
+ * @version October 16, 2026
+ */
+
+#ifndef AGL_SIMD_H_
+#define AGL_SIMD_H_
+
+// SSE2 is part of every x86-64 target; MSVC does not define __SSE2__
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// AVX2 and AVX-512 VBMI are not part of the x86-64 baseline, so code using
+// them is compiled for them one function at a time with AGL_TARGET_AVX2 or
+// AGL_TARGET_VBMI, and only called when aglHasAVX2() or aglHasVBMI() says
+// the CPU (and OS) has them
+#if defined(AGL_SSE2) && (defined(__GNUC__) || defined(_MSC_VER))
+#define AGL_AVX2 1
+#define AGL_VBMI 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AGL_TARGET_AVX2
+#define AGL_TARGET_VBMI
+#else
+#define AGL_TARGET_AVX2 __attribute__((target("avx2")))
+#define AGL_TARGET_VBMI __attribute__((target("avx512bw,avx512vbmi")))
+#endif
+
+#ifdef _MSC_VER
+// true if the CPU has the given leaf 7 feature bits and the OS saves the
+// register state in xcr0Bits
+inline bool aglCpuHas(int ebxBits, int ecxBits, unsigned xcr0Bits) {
+  int info[4];
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & xcr0Bits) != xcr0Bits) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & ebxBits) == ebxBits && (info[2] & ecxBits) == ecxBits;
+}
+#endif
+
+inline bool aglHasAVX2() {
+#if defined(__AVX2__)
+  return true;
+#elif defined(_MSC_VER)
+  static const bool has = aglCpuHas(1 << 5, 0, 0x6);
+  return has;
+#else
+  static const bool has = __builtin_cpu_supports("avx2");
+  return has;
+#endif
+}
+
+inline bool aglHasVBMI() {
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+  return true;
+#elif defined(_MSC_VER)
+  static const bool has = aglCpuHas(1 << 30, 1 << 1, 0xE6);
+  return has;
+#else
+  static const bool has = __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vbmi");
+  return has;
+#endif
+}
+#endif
+
+#endif  // AGL_SIMD_H_